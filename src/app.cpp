@@ -1,30 +1,31 @@
 #include <imgui.h>
 #include <cstdio>
+#include <cctype>
+#include <algorithm>
+#include <string_view>
 #include <sstream>
 #include <cassert>
 #include <cpr/cpr.h>
 #include <unordered_set>
-#include <condition_variable>
 #include "app.hpp"
 #include "sys.hpp"
 #include "json.hpp"
 #include "archive.hpp"
-#include "imgui_markdown.h"
+#include "markdown.hpp"
 #include "util.hpp"
+#include "download.hpp"
+#include "config.hpp"
+#include "catalog.hpp"
+#include "catalog_snapshot.hpp"
+#include "installed.hpp"
+#include "store.hpp"
+#include "side_by_side.hpp"
+#include "cache.hpp"
 
 using namespace nlohmann; // what
 
-const char *USER_AGENT = "RainedVersionManager/" RAINEDUPDATE_VERSION " (" SYS_TRIPLET ") libcpr/" CPR_VERSION " libcurl/" LIBCURL_VERSION;
-
-#if _WIN32
-#define ARCHIVE_EXT ".zip"
-#else
-#define ARCHIVE_EXT ".tar.gz"
-#endif
-
 Application::Application()
 {
-    frame = 0;
     cur_state = AppState::FETCH_LIST;
     selected_version = -1;
     is_rained_installed = true; // will check that it isn't later
@@ -38,205 +39,350 @@ Application::Application()
         rained_dir = std::filesystem::current_path();
     else
         rained_dir = std::filesystem::u8path(rained_env).native();
+
+    start_version_query(true);
 }
 
 Application::~Application()
 {
-
+    // don't keep the window open waiting for requests nobody will see
+    _version_query_cancel.cancel();
+    _closing.cancel();
+
+    // pool futures don't wait on destruction, and the jobs use this object
+    if (_version_query.valid())
+        _version_query.wait();
+    if (_catalog_refresh.valid())
+        _catalog_refresh.wait();
+    if (_catalog_save.valid())
+        _catalog_save.wait();
+    if (_cache_stats_query.valid())
+        _cache_stats_query.wait();
 }
 
-// get the installed rained version by querying the executable
-static bool get_rained_version(const std::filesystem::path &rained_path, std::string &version)
+static void markdown_link_callback(const std::string &url)
 {
-    std::filesystem::path rained_exe_path = rained_path / "Rained";
-
-#if _WIN32
-    std::string const_cmd = rained_exe_path.u8string() + " --console --version";
-#else
-    std::string const_cmd = rained_exe_path.u8string() + " --version";
-#endif
-
-    std::stringstream p_res;
-    if (sys::subprocess(const_cmd, p_res) != 0)
-        return false;
-    
-    std::string res = p_res.str();
+    if (!sys::open_url(url))
+    {
+        fprintf(stderr, "could not open url");
+    }
+}
 
-    if (res.substr(0, 7) != "Rained ")
-        return false;
+size_t Application::version_count() const
+{
+    return _catalog ? _catalog->release_count() : 0;
+}
 
-    version = res.substr(7);
+// select the release that is currently installed, if it is in the list
+void Application::select_current_release()
+{
+    cur_release_info = {};
 
-    // trim whitespace at end
-    for (auto it = version.rbegin(); it != version.rend(); it++)
+    int index = _catalog ? _catalog->find_release(current_version) : -1;
+    if (index >= 0)
     {
-        if (!std::isspace(*it))
-        {
-            version.erase(it.base(), version.end());
-            break;
-        }
+        selected_version = index;
+        cur_release_info = _catalog->release(index).to_release_info();
     }
-
-    return true;
 }
 
-static bool parse_release_info(json &release_json, ReleaseInfo &release)
+// detect the installed rained version and, if need_catalog is true, load the
+// release list. runs on a worker thread, and throws if anything fails.
+static VersionQueryResult query_versions(std::filesystem::path rained_dir, bool need_catalog, const tasks::cancel_token &cancel)
 {
-    release.version_name = release_json.at("name");
+    VersionQueryResult result {};
+    result.is_rained_installed = true;
+
+    // rained not existing is a valid state...
+    if (!std::filesystem::is_regular_file(rained_dir / "Rained") && !std::filesystem::is_regular_file(rained_dir / "Rained.exe"))
+    {
+        result.is_rained_installed = false;
+    }
+    else if (!installed::get_version(rained_dir, result.current_version))
+    {
+        throw std::runtime_error("could not get current rained version");
+    }
+
+    store::installation previous;
+    if (store::load_previous(previous))
+        result.rollback_version = previous.version_name;
 
-    release.api_url = release_json.at("url");
-    release.url = release_json.at("html_url");
+    if (!need_catalog)
+        return result;
 
-    auto assets = release_json.at("assets");
-    if (!assets.is_array()) return false;
+    // without the list there is nothing to choose from
+    if (cancel.is_canceled())
+        throw std::runtime_error("canceled");
 
-    for (auto asset = assets.begin(); asset != assets.end(); asset++)
+    // show the cached list right away, and revalidate it later. if the installed
+    // version is missing from it, the cache is too old to be useful.
+    std::unique_ptr<catalog::snapshot> cached = catalog::open_cache();
+    if (cached && (!result.is_rained_installed || cached->find_release(result.current_version) >= 0))
     {
-        std::string content_type = asset->at("content_type");
-        if (content_type == "application/x-gzip" || content_type == "application/gzip")
-            release.linux_download_url = asset->at("browser_download_url");
-        else if (content_type == "application/x-zip-compressed" || content_type == "application/zip")
-            release.windows_download_url = asset->at("browser_download_url");
+        result.catalog = std::move(cached);
+        result.from_cache = true;
+        return result;
     }
 
-    release.changelog = std::string("[View on GitHub](") + release.url + ")\n" + std::string(release_json.at("body"));
-    return true;
+    catalog::release_catalog fetched;
+    bool changed;
+    if (!catalog::fetch(fetched, changed, cancel.flag()))
+        throw std::runtime_error("could not fetch release list");
+
+    catalog::save_cache(fetched);
+    result.catalog = catalog::snapshot::create(fetched);
+    return result;
 }
 
-static bool fetch_json(const std::string &url, json &result)
+namespace
 {
-    cpr::Response r = cpr::Get(
-        cpr::Url(url),
-        cpr::UserAgent(USER_AGENT)
-    );
-
-    printf("status code: %li\n", r.status_code);
-    printf("content type: %s\n", r.header["content-type"].c_str());
-    if (r.status_code != 200)
+    // wakes the main loop when it goes out of scope, so that the result of a
+    // background job is picked up even if the loop is idle
+    struct wake_on_exit
     {
-        return false;
-    }
+        ~wake_on_exit() { util::wake_main_loop(); }
+    };
+}
 
-    std::string desired_content_type = "application/json";
-    if (r.header["content-type"].substr(0, desired_content_type.length()) != desired_content_type)
+void Application::start_version_query(bool need_catalog)
+{
+    _version_query_cancel = tasks::cancel_token();
+    _version_query = tasks::shared().submit([need_catalog, dir = side_by_side::active_dir(rained_dir), cancel = _version_query_cancel]()
     {
-        return false;
-    }
+        wake_on_exit wake;
+        return query_versions(dir, need_catalog, cancel);
+    });
+}
 
-    result = json::parse(r.text);
-    return true;
+void Application::refresh_cache_stats()
+{
+    // a query that is still running may have read the index before the change
+    _cache_stats_query = tasks::shared().submit([]()
+    {
+        wake_on_exit wake;
+        return cache::get_stats();
+    });
 }
 
-static bool process_rained_versions(std::vector<ReleaseInfo> &releases)
+void Application::poll_cache_stats()
 {
-    printf("update version list\n");
-    releases.clear();
+    if (!_cache_stats_query.valid() || _cache_stats_query.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
 
-    // fetch nightly release first
-    {
-        json result;
-    #ifdef DEBUG
-        std::ifstream test_f("nightly.json");
-        result = json::parse(test_f);
-    #else
-        if (!fetch_json("https://api.github.com/repos/pkhead/rained/releases/tags/nightly", result))
-            return false;
-    #endif
+    try { _cache_stats = _cache_stats_query.get(); }
+    catch (std::exception &e) { fprintf(stderr, "could not read cache statistics: %s\n", e.what()); }
+}
 
-        if (!result.is_object())
-            return false;
+bool Application::is_animating() const
+{
+    // the progress bars of these move on their own
+    return cur_state == AppState::FETCH_LIST || _install_task != nullptr;
+}
 
-        ReleaseInfo release {};
-        if (!parse_release_info(result, release))
-            return false;
+// apply the result of the version query, if it has finished
+void Application::poll_version_query()
+{
+    if (!_version_query.valid() || _version_query.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
 
-        releases.push_back(release);
-    }
+    bool is_startup = cur_state == AppState::FETCH_LIST;
 
-#ifdef DEBUG
-    std::ifstream test_f("releases.json");
-    json result = json::parse(test_f);
-#else
-    json result;
-    if (!fetch_json("https://api.github.com/repos/pkhead/rained/releases", result))
-        return false;
-#endif
-    
-    if (!result.is_array())
-        return false;
-    
-    for (auto it = result.begin(); it != result.end(); it++)
+    try
     {
-        if (!it->is_object()) return false;
+        VersionQueryResult result = _version_query.get();
+        is_rained_installed = result.is_rained_installed;
+        current_version = result.current_version;
+
+        _rollback_label.clear();
+        if (!result.rollback_version.empty())
+            _rollback_label = "Roll Back to " + result.rollback_version + "###Rollback";
 
-        // don't process nightly, code explcitly fetched data for that earlier
-        if (it->at("tag_name") == "nightly") continue;
+        if (result.catalog)
+            _catalog = std::move(result.catalog);
 
-        ReleaseInfo release{};
-        if (!parse_release_info(*it, release))
-            return false;
+        if (result.from_cache)
+        {
+            // revalidate in the background. the snapshot stays as it is, and
+            // a changed catalog comes back as a new one.
+            _catalog_refresh = tasks::shared().submit([snap = _catalog, cancel = _closing]() -> std::shared_ptr<const catalog::snapshot>
+            {
+                wake_on_exit wake;
+                catalog::release_catalog refreshed;
+                snap->read(refreshed);
+
+                bool changed;
+                if (!catalog::fetch(refreshed, changed, cancel.flag()) || !changed)
+                    return nullptr;
+
+                return catalog::snapshot::create(refreshed);
+            });
+        }
 
-        releases.push_back(release);
+        select_current_release();
+        rebuild_version_list();
+        if (is_rained_installed && cur_release_info.url.empty())
+            throw std::runtime_error("could not find current release info...");
     }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "error fetching current version: %s\n", e.what());
 
-    return true;
-}
+        if (is_startup)
+        {
+            cur_state = AppState::FETCH_LIST_ERROR;
+        }
+        else
+        {
+            current_version.clear();
+        }
 
-static void markdown_link_callback(ImGui::MarkdownLinkCallbackData data)
-{
-    if (data.isImage) return;
-    if (!sys::open_url(std::string(data.link, data.linkLength)))
+        return;
+    }
+
+    if (is_startup)
     {
-        fprintf(stderr, "could not open url");
+        cur_state = AppState::CHOOSE_VERSION;
+        prefetch_latest_version();
     }
 }
 
-bool Application::query_current_version()
+// apply the result of the background catalog revalidation, if it has finished
+void Application::poll_catalog_refresh()
 {
-    is_rained_installed = true;
+    if (!_catalog_refresh.valid() || _catalog_refresh.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        return;
 
-    // rained not existing is a valid state...
-    if (!std::filesystem::is_regular_file(rained_dir / "Rained") && !std::filesystem::is_regular_file(rained_dir / "Rained.exe"))
-    {
-        is_rained_installed = false;
-        current_version.clear();
-    }
-    else if (!get_rained_version(rained_dir, current_version))
+    std::shared_ptr<const catalog::snapshot> result;
+    try { result = _catalog_refresh.get(); }
+    catch (std::exception &e) { fprintf(stderr, "could not refresh release list: %s\n", e.what()); }
+
+    if (!result) return;
+    printf("release list changed\n");
+
+    // keep the same version selected
+    std::string selected_name;
+    if (selected_version >= 0)
+        selected_name = _catalog->release(selected_version).version_name;
+
+    // the old snapshot is unmapped here, so saving can replace its file
+    _catalog = std::move(result);
+    _changelogs.clear();
+
+    _catalog_save = tasks::shared().submit([snap = _catalog]()
     {
-        return false;
-    }
+        try { catalog::save_cache(*snap); }
+        catch (std::exception &e) { fprintf(stderr, "could not save release list: %s\n", e.what()); }
+    });
+
+    ReleaseInfo old_release_info = cur_release_info;
+    select_current_release();
 
-    bool is_nightly = current_version.find("dev") != std::string::npos || current_version.find("nightly") != std::string::npos;
-    if (!available_versions.empty() || process_rained_versions(available_versions))
+    // the installed version vanished from the list; keep showing it
+    if (is_rained_installed && cur_release_info.url.empty())
+        cur_release_info = old_release_info;
+
+    selected_version = -1;
+    for (size_t i = 0; i < version_count(); i++)
     {
-        // set selected version to current
-        for (unsigned int i = 0; i < available_versions.size(); i++)
+        if (_catalog->release(i).version_name == selected_name)
         {
-            if (available_versions[i].version_name == current_version || (is_nightly && available_versions[i].version_name == "Nightly"))
-            {
-                selected_version = i;
-                cur_release_info = available_versions[i];
-                break;
-            }
+            selected_version = i;
+            break;
         }
+    }
 
-        if (is_rained_installed && cur_release_info.url.empty())
-            throw std::runtime_error("could not find current release info...");
+    rebuild_version_list();
+}
 
-        cur_state = AppState::CHOOSE_VERSION;
+// build the search index of the version list. call when the list or the
+// current release changes. the other labels of the version list are the
+// names in the snapshot.
+void Application::rebuild_version_list()
+{
+    _current_label = cur_release_info.version_name + " (current)";
+
+    // lowercased once here, so typing in the search box doesn't redo it for
+    // every release on each keystroke
+    _version_search_index.clear();
+    _version_search_index.reserve(version_count());
+    for (size_t i = 0; i < version_count(); i++)
+    {
+        std::string lower(_catalog->release(i).version_name);
+        for (char &c : lower)
+            c = (char) std::tolower((unsigned char) c);
+        _version_search_index.push_back(std::move(lower));
     }
-    else
+
+    filter_version_list();
+}
+
+// find the versions that match the search box
+void Application::filter_version_list()
+{
+    std::string query = _version_filter;
+    for (char &c : query)
+        c = (char) std::tolower((unsigned char) c);
+
+    _filtered_versions.clear();
+    for (size_t i = 0; i < _version_search_index.size(); i++)
     {
-        return false;
+        if (_version_search_index[i].find(query) != std::string::npos)
+            _filtered_versions.push_back((int) i);
     }
-    
-    return true;
+}
+
+static std::string format_size(uint64_t bytes)
+{
+    if (bytes >= (1ULL << 30))
+        return util::format("%.1f GiB", (double)bytes / (1ULL << 30));
+
+    return util::format("%.1f MiB", (double)bytes / (1ULL << 20));
 }
 
 void Application::render_main_window()
 {
     ImGui::BeginMenuBar();
     {
+        if (ImGui::BeginMenu("Settings"))
+        {
+            config::settings cfg = config::get();
+            if (ImGui::MenuItem("Download selected version in background", nullptr, &cfg.prefetch_releases))
+            {
+                config::set(cfg);
+
+                if (cfg.prefetch_releases && selected_version >= 0)
+                    prefetch_version(_catalog->release(selected_version).to_release_info());
+                else if (!cfg.prefetch_releases)
+                    _prefetch_task = nullptr;
+            }
+
+            // the copy from after the last install is shown until this one is ready
+            poll_cache_stats();
+            if (!_settings_menu_open)
+                refresh_cache_stats();
+            _settings_menu_open = true;
+
+            ImGui::Separator();
+            if (_cache_stats)
+            {
+                const cache::stats &stats = *_cache_stats;
+                ImGui::TextDisabled("Cache: %zu archives, %s of %s", stats.archive_count,
+                    format_size(stats.total_size).c_str(), stats.budget > 0 ? format_size(stats.budget).c_str() : "unlimited");
+                ImGui::TextDisabled("%.0f%% of requests served from the cache, %s saved",
+                    stats.hit_rate() * 100.0f, format_size(stats.bytes_saved).c_str());
+            }
+            else
+            {
+                ImGui::TextDisabled("Cache: ...");
+            }
+
+            ImGui::EndMenu();
+        }
+        else
+        {
+            _settings_menu_open = false;
+        }
+
         if (ImGui::MenuItem("About"))
         {
             about_window_open = true;
@@ -254,21 +400,22 @@ void Application::render_main_window()
         } ImGui::End();
     }
 
+    poll_version_query();
+
     switch (cur_state)
     {
         case AppState::FETCH_LIST:
         {
             ImGui::Text("Fetching current Rained version...");
+            ImGui::ProgressBar(-1.0f * (float)ImGui::GetTime(), ImVec2(ImGui::GetFontSize() * 20.0f, 0.0f));
 
-            if (frame > 10)
+            if (_version_query_cancel.is_canceled())
             {
-                bool success;
-
-                try { success = query_current_version(); }
-                catch (...) { success = false; }
-
-                if (!success)
-                    cur_state = AppState::FETCH_LIST_ERROR;
+                ImGui::TextDisabled("Canceling...");
+            }
+            else if (ImGui::Button("Cancel"))
+            {
+                _version_query_cancel.cancel();
             }
 
             break;
@@ -276,31 +423,57 @@ void Application::render_main_window()
         
         case AppState::FETCH_LIST_ERROR:
         {
-            ImGui::Text("An error occured. Please try again later.");
+            if (_version_query_cancel.is_canceled())
+                ImGui::Text("Canceled.");
+            else
+                ImGui::Text("An error occured. Please try again later.");
+
+            if (ImGui::Button("Retry"))
+            {
+                cur_state = AppState::FETCH_LIST;
+                start_version_query(true);
+            }
+
             break;
         }
         
         case AppState::CHOOSE_VERSION:
         {
+            poll_catalog_refresh();
+
             if (is_rained_installed)
                 ImGui::Text("Current version: %s", current_version.c_str());
 
             ImGuiChildFlags child_flags = ImGuiChildFlags_Border | ImGuiChildFlags_ResizeX;
             ImGui::BeginChild("Version List", ImVec2(ImGui::GetFontSize() * 10.0f, -FLT_MIN), child_flags);
             {
-                int index = 0;
-                for (auto it = available_versions.begin(); it != available_versions.end(); it++)
+                ImGui::SetNextItemWidth(-FLT_MIN);
+                if (ImGui::InputTextWithHint("##Filter", "Search", _version_filter, sizeof(_version_filter)))
+                    filter_version_list();
+
+                // only the visible rows are submitted
+                ImGuiListClipper clipper;
+                clipper.Begin((int) _filtered_versions.size());
+                while (clipper.Step())
                 {
-                    std::string label;
-                    if (it->version_name == cur_release_info.version_name)
-                        label = it->version_name + " (current)";
-                    else
-                        label = it->version_name;
-                        
-                    if (ImGui::Selectable(label.c_str(), index == selected_version))
-                        selected_version = index;
-
-                    index++;
+                    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++)
+                    {
+                        int index = _filtered_versions[row];
+                        catalog::snapshot::release_view release = _catalog->release(index);
+
+                        // names in the snapshot are null-terminated
+                        const char *label = release.version_name.data();
+                        if (release.version_name == cur_release_info.version_name)
+                            label = _current_label.c_str();
+
+                        ImGui::PushID(index);
+                        if (ImGui::Selectable(label, index == selected_version))
+                        {
+                            selected_version = index;
+                            prefetch_version(release.to_release_info());
+                        }
+                        ImGui::PopID();
+                    }
                 }
             }
             ImGui::EndChild();
@@ -312,12 +485,15 @@ void Application::render_main_window()
             {
                 ImVec2 content_region_avail = ImGui::GetContentRegionAvail();
                 ImGui::BeginChild("Changelog", ImVec2(content_region_avail.x, content_region_avail.y - ImGui::GetFrameHeight() - ImGui::GetStyle().ItemSpacing.y));
-                ReleaseInfo &release = available_versions[selected_version];
+                catalog::snapshot::release_view release = _catalog->release(selected_version);
+                std::string version_name(release.version_name);
 
-                ImGui::MarkdownConfig md_config{};
-                md_config.formatCallback = ImGui::defaultMarkdownFormatCallback;
-                md_config.linkCallback = markdown_link_callback;
-                ImGui::Markdown(release.changelog.c_str(), release.changelog.length(), md_config);
+                // changelogs are parsed once, and laid out again only when the width changes
+                auto changelog = _changelogs.find(version_name);
+                if (changelog == _changelogs.end())
+                    changelog = _changelogs.emplace(version_name, markdown::document(std::string(release.changelog))).first;
+
+                changelog->second.render(ImGui::GetContentRegionAvail().x, markdown_link_callback);
 
                 ImGui::EndChild();
 
@@ -327,9 +503,30 @@ void Application::render_main_window()
                     btn_name = "Sync###Install";
                 }
 
-                if (ImGui::Button(btn_name))
+                // the installed version is still being checked after an install
+                if (ImGui::Button(btn_name) && !_version_query.valid())
+                {
+                    install_version(release.to_release_info());
+                }
+
+                if (!_rollback_label.empty())
+                {
+                    ImGui::SameLine();
+                    if (ImGui::Button(_rollback_label.c_str()) && !_version_query.valid())
+                        roll_back();
+                }
+
+                if (!_rollback_result.empty())
                 {
-                    install_version(available_versions[selected_version]);
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("%s", _rollback_result.c_str());
+                }
+
+                float prefetch_progress;
+                if (_prefetch_task && _prefetch_task->release().version_name == release.version_name && _prefetch_task->get_progress(prefetch_progress))
+                {
+                    ImGui::SameLine();
+                    ImGui::TextDisabled("Downloading in background... %i%%", (int)(prefetch_progress * 100.0f));
                 }
             }
 
@@ -340,24 +537,23 @@ void Application::render_main_window()
 
     if (_install_task)
     {
-        std::string prog_msg;
+        _install_task->poll_events();
+
         float progress_value;
-        bool is_done = !_install_task->get_progress(prog_msg, progress_value);
-        bool is_faulted = _install_task->get_exception(prog_msg);
+        bool is_done = !_install_task->get_progress(progress_value);
+        bool is_faulted = _install_task->is_faulted();
 
         if (is_done && !is_faulted)
         {
-            _install_task = nullptr;
-
-            bool s;
-            try { s = query_current_version(); }
-            catch (...) { s = false; }
-
-            if (!s)
+            if (_install_task->is_rollback() && !_install_task->installed_version().empty())
             {
-                fprintf(stderr, "error fetching current version");
-                current_version.clear();
+                _rollback_result = util::format("Rolled back to %s in %lld ms",
+                    _install_task->installed_version().c_str(), (long long)_install_task->elapsed().count());
             }
+
+            _install_task = nullptr;
+            start_version_query(false);
+            refresh_cache_stats();
         }
         else
         {
@@ -372,7 +568,17 @@ void Application::render_main_window()
 
                 if (!is_faulted)
                 {
-                    ImGui::TextWrapped("%s", prog_msg.c_str());
+                    ImGui::TextWrapped("%s", _install_task->status().c_str());
+
+                    int retries, stalls;
+                    bool waiting;
+                    if (_install_task->get_download_stats(retries, stalls, waiting))
+                    {
+                        if (waiting)
+                            ImGui::TextWrapped("Connection lost, retrying (attempt %i)...", retries + 1);
+                        else if (retries > 0)
+                            ImGui::TextWrapped("Resumed after %i retries (%i stalls)", retries, stalls);
+                    }
 
                     if (progress_value >= 0.0f)
                     {
@@ -388,7 +594,7 @@ void Application::render_main_window()
                 }
                 else
                 {
-                    ImGui::TextWrapped("ERROR! %s", prog_msg.c_str());
+                    ImGui::TextWrapped("ERROR! %s", _install_task->exception().c_str());
                     if (ImGui::Button("OK"))
                     {
                         ImGui::CloseCurrentPopup();
@@ -396,15 +602,14 @@ void Application::render_main_window()
                 }
 
                 // handle any overwrite prompts
-                OverwritePromptInfo prompt_info;
-                if (_install_task->get_overwrite_prompt(prompt_info))
+                if (const std::string *prompt_path = _install_task->get_overwrite_prompt())
                 {
                     if (!ImGui::IsPopupOpen("Overwrite?"))
                         ImGui::OpenPopup("Overwrite?");
 
                     if (ImGui::BeginPopupModal("Overwrite?", nullptr, ImGuiWindowFlags_AlwaysAutoResize))
                     {
-                        ImGui::Text("Local changes were detected in %s.", prompt_info.display_file_path.c_str());
+                        ImGui::Text("Local changes were detected in %s.", prompt_path->c_str());
                         ImGui::Separator();
                         if (ImGui::Button("Overwrite Changes"))
                         {
@@ -433,8 +638,6 @@ void Application::render_main_window()
             }
         }
     }
-    
-    frame++;
 }
 
 
@@ -448,406 +651,655 @@ void Application::render_main_window()
 // INSTALLATION TASK //
 ///////////////////////
 
-InstallTask::InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release) :
+InstallTask::InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release, std::unique_ptr<PrefetchTask> prefetch) :
+    InstallTask(rained_dir, cur_release, desired_release, std::move(prefetch), false)
+{}
+
+InstallTask::InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release, std::unique_ptr<PrefetchTask> prefetch, bool is_rollback) :
     _rained_dir(rained_dir),
+    _prefetch(std::move(prefetch)),
+    _elapsed(0),
     cur_release(cur_release),
-    desired_release(desired_release)
+    desired_release(desired_release),
+    _is_rollback(is_rollback)
 {
     _progress = 0;
+    _download_retries = 0;
+    _download_stalls = 0;
+    _download_waiting = false;
     _cancel_requested = false;
-    _is_thread_done = false;
-    _thread_faulted = false;
+    _prompt_result = -1;
+
+    _is_download_status = false;
+    _has_prompt = false;
+    _is_faulted = false;
+    _is_done = false;
 
-    _thread = std::thread(&InstallTask::_thread_proc, this);
+    _job = tasks::shared().submit([this]() { _thread_proc(); });
 }
 
-bool InstallTask::get_progress(std::string &out_msg, float &out_progress)
+void InstallTask::poll_events()
 {
-    std::lock_guard guard(_mutex);
-    if (_is_thread_done) return false;
+    InstallEvent event;
+    while (_events.try_pop(event))
+    {
+        switch (event.type)
+        {
+            case InstallEventType::STATUS:
+            case InstallEventType::DOWNLOAD_STATUS:
+                _status.swap(event.text);
+                _is_download_status = event.type == InstallEventType::DOWNLOAD_STATUS;
+                break;
 
-    out_msg = _prog_msg;
-    out_progress = _progress;
+            case InstallEventType::OVERWRITE_PROMPT:
+                _prompt_path.swap(event.text);
+                _has_prompt = true;
+                break;
 
-    return true;
+            case InstallEventType::FAULTED:
+                _exception.swap(event.text);
+                _is_faulted = true;
+                _is_done = true;
+                break;
+
+            case InstallEventType::FINISHED:
+                _is_done = true;
+                break;
+        }
+    }
 }
 
-bool InstallTask::get_exception(std::string &out_except)
+bool InstallTask::get_progress(float &out_progress) const
 {
-    std::lock_guard guard(_mutex);
-    if (_is_thread_done && _thread_faulted)
-    {
-        out_except = _thread_exception;
-        return true;
-    }
+    if (_is_done) return false;
+
+    out_progress = _progress;
+    return true;
+}
 
-    return false;
+bool InstallTask::get_download_stats(int &out_retries, int &out_stalls, bool &out_waiting) const
+{
+    out_retries = _download_retries;
+    out_stalls = _download_stalls;
+    out_waiting = _download_waiting;
+    return _is_download_status;
 }
 
 void InstallTask::cancel()
 {
-    std::lock_guard guard(_mutex);
     _cancel_requested = true;
 }
 
-bool InstallTask::get_overwrite_prompt(OverwritePromptInfo &out_prompt_info) const
+const std::string* InstallTask::get_overwrite_prompt() const
 {
-    if (_overwrite_prompt)
-    {
-        out_prompt_info.display_file_path = _overwrite_prompt->display_file_path;
-        out_prompt_info.cv = _overwrite_prompt->cv;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    return _has_prompt ? &_prompt_path : nullptr;
 }
 
 void InstallTask::set_overwrite_prompt_result(int condition)
 {
-    std::lock_guard lock(_mutex);
-    if (_overwrite_prompt)
-    {
-        _overwrite_prompt->user_input = condition;
-        _overwrite_prompt->cv->notify_all();
-    }
+    if (!_has_prompt) return;
+
+    _has_prompt = false;
+    _prompt_result = condition;
+}
+
+// called on the job. the queue is drained every frame, so it is only full
+// if the ui is stalled, like while the window is minimized.
+void InstallTask::send_event(InstallEventType type, std::string text)
+{
+    InstallEvent event { type, std::move(text) };
+    while (!_events.try_push(std::move(event)))
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    util::wake_main_loop();
 }
 
 int InstallTask::prompt_overwrite(const std::filesystem::path &file_path)
 {
+    _prompt_result = -1;
+    send_event(InstallEventType::OVERWRITE_PROMPT, file_path.u8string()); // file_path is already relative here
+
+    // waiting on a person, so polling is plenty
+    int result;
+    while ((result = _prompt_result) == -1)
     {
-        std::unique_ptr<OverwritePromptInfo> info = std::make_unique<OverwritePromptInfo>();
-        info->display_file_path = file_path.u8string(); // file_path is already relative here
-        info->user_input = -1;
-        info->cv = std::make_shared<std::condition_variable>();
+        if (_cancel_requested)
+            return 2;
 
-        auto lock = std::lock_guard(_mutex);
-        _overwrite_prompt = std::move(info);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
     }
 
-    std::unique_lock lock(_mutex);
-    _overwrite_prompt->cv->wait(lock, [&]{ return this->_overwrite_prompt->user_input != -1; });
-    
-    if (!lock.owns_lock())
-        lock.lock();
-    int ret = _overwrite_prompt->user_input;
-    _overwrite_prompt = nullptr;
-    lock.unlock();
+    return result;
+}
 
-    return ret;
+std::unique_ptr<InstallTask> InstallTask::rollback(const std::filesystem::path &rained_dir)
+{
+    return std::unique_ptr<InstallTask>(new InstallTask(rained_dir, {}, {}, nullptr, true));
 }
 
 void InstallTask::_thread_proc()
 {
     try
     {
-        _install();
+        auto start_time = std::chrono::steady_clock::now();
 
-        auto guard = std::lock_guard(_mutex);
-        _is_thread_done = true;
-    }
-    catch (std::runtime_error e)
-    {
-        auto guard = std::lock_guard(_mutex);
-        _thread_faulted = true;
-        _thread_exception = e.what();
-        _is_thread_done = true;
-    }
-}
+        if (_is_rollback)
+            _rollback();
+        else
+            _install();
 
-static const std::filesystem::path rainedvm_path()
-{
-    static bool need_init = true;
-    static std::filesystem::path path;
+        _elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
 
-    if (need_init)
-    {
-        need_init = false;
+        // an install may have added an archive, and both change which ones are pinned
+        if (!_installed_version.empty())
+            cache::enforce_budget();
 
-        path = std::filesystem::path(".rainedvm");
-        if (!std::filesystem::exists(path))
-            std::filesystem::create_directory(path);
+        send_event(InstallEventType::FINISHED, {});
+    }
+    catch (std::exception &e)
+    {
+        send_event(InstallEventType::FAULTED, e.what());
     }
-
-    return path;
 }
 
-static std::filesystem::path download_release(const ReleaseInfo &release, std::function<bool(float)> progress_callback)
+bool InstallTask::remove_files(const std::vector<std::filesystem::path> &files, const std::function<bool(size_t)> &is_changed, std::unordered_set<std::filesystem::path::string_type> &ignore_list)
 {
-    std::filesystem::path root_dir = rainedvm_path();
-
-    // install zip
-    std::filesystem::path archive_path = root_dir / std::filesystem::path("rained-" + release.version_name);
-    std::string download_url;
+    // remove all files that were downloaded for this version
+    std::unordered_set<std::filesystem::path::string_type> directories;
 
-    #if defined(_WIN32)
-    if (strcmp(SYS_ARCH, "x86_64") == 0)
-        download_url = release.windows_download_url;
-#elif defined(__linux__)
-    if (strcmp(SYS_ARCH, "x86_64") == 0)
-        download_url = release.linux_download_url;
-#elif defined(__APPLE__)
-    if (strcmp(SYS_ARCH, "x86_64") == 0)
-        download_url = release.macos_download_url;
-#endif
+    std::filesystem::path vm_exe_path = std::filesystem::path(sys::arguments()[0]).filename();
 
-    if (download_url.empty())
-        throw std::runtime_error("ERROR: no " SYS_OS  " download for " + release.version_name);
-
-#ifdef _WIN32
-    std::filesystem::path download_archive_path = root_dir / std::filesystem::path("rained-" + release.version_name + ".zip");
-#elif defined(__linux__)
-    std::filesystem::path download_archive_path = root_dir / std::filesystem::path("rained-" + release.version_name + ".tar.gz");
-#else
-    #error No version downloader for this platform
-#endif
-
-    // download archive
-    bool canceled = false;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const std::filesystem::path &path = files[i];
 
-    // delete nightly cache, since it can change
-    if (release.version_name == "Nightly" && std::filesystem::exists(download_archive_path))
-        std::filesystem::remove(download_archive_path);
+        // don't delete the version manager executable or config/imgui.ini
+        // and additionally, make sure that they aren't replaced when installing
+        bool ignore_file = path == vm_exe_path || path == "config/imgui.ini";
 
-    if (!std::filesystem::exists(download_archive_path))
-    {
-        if (!progress_callback(0.0f)) return download_archive_path;
+        std::filesystem::path file_dest_path = _rained_dir / path;
 
-        std::ofstream ar_of(download_archive_path, std::ios::binary);
-        cpr::Response r = cpr::Download(ar_of,
-            cpr::Url(download_url),
-            cpr::UserAgent(USER_AGENT),
-            cpr::ProgressCallback([&](cpr::cpr_off_t download_total, cpr::cpr_off_t download_now, cpr::cpr_off_t, cpr::cpr_off_t, intptr_t)
+        // don't perform any checks in the drizzle cast folder
+        // which, depending on the version, may be called "internal" or "drizzle-cast"
+        std::string path_str = path.u8string();
+        if (!ignore_file &&
+            path_str.substr(0, 15) != "assets/internal" &&
+            path_str.substr(0, 19) != "assets/drizzle-cast" &&
+            std::filesystem::is_regular_file(file_dest_path))
+        {
+            if (is_changed(i))
             {
-                canceled = !progress_callback((float)download_now / download_total);
-                return !canceled;
-            })
-        );
+                printf("changed: %s\n", path.u8string().c_str());
+                int overwrite_result = prompt_overwrite(path);
+                if (overwrite_result == 2) // canceled
+                    return false;
+                ignore_file = overwrite_result == 0;
+            }
+        }
 
-        if (r.status_code != 200)
-            throw std::runtime_error("ERROR: http download status code is " + std::to_string(r.status_code));
+        if (ignore_file)
+        {
+            if (std::filesystem::exists(file_dest_path))
+                ignore_list.emplace(path.native());
+        }
+        else
+        {
+            std::filesystem::remove(file_dest_path);
+
+            if (path.has_parent_path())
+                directories.emplace(path.parent_path().native());
+        }
     }
 
-    if (canceled)
+    // remove empty directories
+    for (auto &dir_path : directories)
     {
-        std::filesystem::remove(download_archive_path);
-        return "";
+        std::filesystem::path abs_path = _rained_dir / dir_path;
+        if (std::filesystem::is_directory(abs_path) && std::filesystem::is_empty(abs_path))
+            std::filesystem::remove(abs_path);
     }
 
-    return download_archive_path;
+    return true;
 }
 
-static std::unique_ptr<archive::basic_archive> read_archive_for_platform(std::filesystem::path archive_path)
+// keep a copy of the archive of the installed version, which uninstalling and
+// verifying read. a reflink makes this instant where the filesystem supports it.
+static void save_current_archive(const std::filesystem::path &archive_path)
 {
-    #ifdef _WIN32
-    archive::basic_archive *archive = new archive::zip_archive(archive_path);
-    #elif defined(__linux__)
-    archive::basic_archive *archive = new archive::tar_archive(archive::tar_archive::from_gzipped(archive_path));
-    #else
-    #error archive type for current platform is undefined
-    #endif
+    std::filesystem::path cur_release_archive = download::rainedvm_path() / ("rained-current" ARCHIVE_EXT);
 
-    return std::unique_ptr<archive::basic_archive>(archive);
+    std::error_code ec;
+    std::filesystem::remove(cur_release_archive, ec);
+    if (!sys::clone_file(archive_path, cur_release_archive))
+        std::filesystem::copy_file(archive_path, cur_release_archive);
+}
+
+// when the files of a version that is now active were put in place. with
+// side-by-side installs, a switch makes active files installed long before.
+static std::filesystem::file_time_type active_install_time(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    if (side_by_side::enabled())
+        return side_by_side::installed_time(rained_dir, version_name);
+
+    return std::filesystem::file_time_type::clock::now();
 }
 
 void InstallTask::_install()
 {
-    std::filesystem::path rvm_path = rainedvm_path();
-    std::string prog_msg;
+    std::filesystem::path rvm_path = download::rainedvm_path();
     bool is_old_nightly = cur_release.version_name == "Nightly";
     bool is_new_nightly = desired_release.version_name == "Nightly";
 
-    auto progress_callback = [&](float prog)
+    // called on every transfer tick, so this only publishes the numbers
+    auto progress_callback = [&](const download::progress &prog)
     {
-        std::lock_guard guard(_mutex);
-        _prog_msg = prog_msg;
-        _progress = prog;
-
+        _progress = prog.fraction;
+        _download_retries = prog.retries;
+        _download_stalls = prog.stalls;
+        _download_waiting = prog.waiting;
         return !_cancel_requested;
     };
 
-    // install zip
-    std::filesystem::path cur_release_archive = rvm_path / ("rained-current" ARCHIVE_EXT);
-    if (!std::filesystem::exists(cur_release_archive))
+    bool is_side_by_side = side_by_side::enabled();
+
+    // a versioned release that is already installed side by side only needs to
+    // be switched to. nightly may have changed since, so it is installed again.
+    if (is_side_by_side && !is_new_nightly && side_by_side::is_installed(_rained_dir, desired_release.version_name))
+    {
+        _progress = -1.0f;
+        send_event(InstallEventType::STATUS, util::format("Switching to %s...", desired_release.version_name.c_str()));
+        side_by_side::activate(_rained_dir, desired_release.version_name);
+
+        // without the archive, the switched-to version can't be verified
+        sys::file_lock archive_lock;
+        std::filesystem::path archive_path = download::lock_cached_release(desired_release, archive_lock, progress_callback);
+        if (!archive_path.empty())
+            save_current_archive(archive_path);
+        else
+            std::filesystem::remove(rvm_path / ("rained-current" ARCHIVE_EXT));
+
+        std::vector<store::file_entry> files;
+        if (store::load_version(desired_release.version_name, {}, files))
+            store::record_installed(desired_release.version_name, files, side_by_side::installed_time(_rained_dir, desired_release.version_name));
+
+        installed::record_version(side_by_side::active_dir(_rained_dir), desired_release.version_name);
+        _installed_version = desired_release.version_name;
+        return;
+    }
+
+    // the files of the current version are known from the store if it was
+    // installed from there, which saves reading its archive to uninstall it
+    store::installation cur_installation;
+    bool has_cur_installation = !is_side_by_side &&
+        store::load_installed(cur_installation) && cur_installation.version_name == cur_release.version_name;
+
+    // install zip. side-by-side installs leave the current version where it is.
+    // the archives in the cache stay locked while they are used, so other
+    // instances sharing the cache don't evict them.
+    std::filesystem::path cur_release_archive;
+    sys::file_lock cur_archive_lock;
+    if (!is_side_by_side && !has_cur_installation)
     {
-        if (!cur_release.url.empty())
+        cur_release_archive = rvm_path / ("rained-current" ARCHIVE_EXT);
+        if (!std::filesystem::exists(cur_release_archive))
         {
-            if (is_old_nightly)
+            if (!cur_release.url.empty())
             {
-                if (!std::filesystem::exists(cur_release_archive))
-                    cur_release_archive = rvm_path / ("rained-Nightly" ARCHIVE_EXT);
+                if (is_old_nightly)
+                {
+                    if (download::lock_release(cur_release, cur_archive_lock, progress_callback))
+                        cur_release_archive = download::cache_path() / ("rained-Nightly" ARCHIVE_EXT);
+                }
+                else
+                {
+                    send_event(InstallEventType::DOWNLOAD_STATUS, "Fetching current version...");
+                    cur_release_archive = download::download_release(cur_release, progress_callback, &cur_archive_lock);
+                }
+
+                if (_cancel_requested) return;
             }
             else
             {
-                prog_msg = "Fetching current version...";
-                cur_release_archive = download_release(cur_release, progress_callback);
+                cur_release_archive.clear();
             }
-
-            if (_cancel_requested) return; // too lazy to lock mutex
         }
+    }
+
+    _progress = 0.0f;
+    send_event(InstallEventType::DOWNLOAD_STATUS, util::format("Fetching %s...", desired_release.version_name.c_str()));
+
+    // if the release was already being downloaded in the background, let that finish
+    if (_prefetch)
+    {
+        _prefetch->wait(progress_callback);
+        _prefetch = nullptr;
+        if (_cancel_requested) return;
+    }
+
+    // if possible, extract the new version into a staging directory while it is
+    // still downloading. it gets moved into the store before the old version is removed.
+    std::filesystem::path staging_dir = rvm_path / "staging";
+    std::vector<std::filesystem::path> staged_files;
+    std::filesystem::path new_release_archive;
+    sys::file_lock new_archive_lock;
+
+    bool is_staged = false;
+
+    // first try to build the archive out of cached archives, if a block map for it
+    // is available. this only downloads the parts that changed.
+    if (!download::is_release_cached(desired_release))
+    {
+        new_release_archive = download::download_release_delta(desired_release, progress_callback, &new_archive_lock);
+        if (_cancel_requested) return;
+    }
+
+    if (new_release_archive.empty())
+    {
+        is_staged = download::can_stream_release(desired_release);
+
+        if (is_staged)
+            new_release_archive = download::download_release_streamed(desired_release, staging_dir, staged_files, progress_callback, &new_archive_lock);
         else
+            new_release_archive = download::download_release(desired_release, progress_callback, &new_archive_lock);
+    }
+
+    if (_cancel_requested) return;
+
+    // gather the files of the new version in the store, which keeps the files
+    // that versions share only once. a version that is already in there
+    // doesn't need to be extracted again.
+    std::vector<store::file_entry> new_files;
+    if (is_staged || !store::load_version(desired_release.version_name, new_release_archive, new_files))
+    {
+        _progress = -1.0f;
+        send_event(InstallEventType::STATUS, util::format("Unpacking %s...", desired_release.version_name.c_str()));
+
+        if (!is_staged)
         {
-            cur_release_archive.clear();
+            std::filesystem::remove_all(staging_dir);
+            std::filesystem::create_directories(staging_dir);
+
+            auto ar_for_new = archive::open_release_archive(new_release_archive);
+            ar_for_new->extract_all(staging_dir);
+            staged_files = ar_for_new->files();
         }
+
+        new_files = store::import_files(staging_dir, staged_files);
+        store::save_version(desired_release.version_name, new_release_archive, new_files);
+        std::filesystem::remove_all(staging_dir);
     }
 
-    prog_msg = util::format("Fetching %s...", desired_release.version_name.c_str());
-    std::filesystem::path new_release_archive = download_release(desired_release, progress_callback);
-    if (_cancel_requested) return; // to lazy to lock mutex
+    if (_cancel_requested) return;
 
     std::unordered_set<std::filesystem::path::string_type> ignore_list;
 
-    if (!cur_release_archive.empty())
+    if (has_cur_installation)
     {
-        {
-            std::lock_guard guard(_mutex);
-            _prog_msg = "Removing old version...";
-            _progress = -1.0f;
-        }
+        _progress = -1.0f;
+        send_event(InstallEventType::STATUS, "Removing old version...");
 
-        auto ar_for_cur = read_archive_for_platform(cur_release_archive);
+        auto &files = cur_installation.files;
+        std::vector<std::filesystem::path> paths;
+        for (auto &file : files)
+            paths.push_back(file.path);
 
-        // remove all files that were downloaded for this version
-        // TODO: if the user tampered with the file, ask if they want it overwritten
-        std::unordered_set<std::filesystem::path::string_type> directories;
+        bool is_done = remove_files(paths, [&](size_t index)
+        {
+            return !store::matches(files[index], _rained_dir / files[index].path);
+        }, ignore_list);
 
-        std::filesystem::path vm_exe_path = std::filesystem::path(sys::arguments()[0]).filename();
+        if (!is_done) return;
+    }
+    else if (!cur_release_archive.empty())
+    {
+        _progress = -1.0f;
+        send_event(InstallEventType::STATUS, "Removing old version...");
 
+        auto ar_for_cur = archive::open_release_archive(cur_release_archive);
         auto &files = ar_for_cur->files();
-        for (auto &path : files)
+
+        bool is_done = remove_files(files, [&](size_t index)
         {
-            // don't delete the version manager executable or config/imgui.ini
-            // and additionally, make sure that they aren't replaced when installing
-            bool ignore_file = path == vm_exe_path || path == "config/imgui.ini";
-
-            std::filesystem::path file_dest_path = _rained_dir / path;
-
-            // don't perform any checks in the drizzle cast folder
-            // which, depending on the version, may be called "internal" or "drizzle-cast"
-            std::string path_str = path.u8string();
-            if (!ignore_file &&
-                path_str.substr(0, 15) != "assets/internal" &&
-                path_str.substr(0, 19) != "assets/drizzle-cast" &&
-                std::filesystem::is_regular_file(file_dest_path))
-            {
-                bool is_different = false;
+            std::filesystem::path file_dest_path = _rained_dir / files[index];
+            bool is_different = false;
 
-                std::ifstream file_data(file_dest_path, std::ios::binary);
-                if (file_data.is_open())
+            std::ifstream file_data(file_dest_path, std::ios::binary);
+            if (file_data.is_open())
+            {
+                std::stringstream orig_data;
+                ar_for_cur->extract_file(files[index], orig_data);
+
+                char buf0[1024];
+                char buf1[1024];
+                std::streamsize buf0_read = 0;
+                std::streamsize buf1_read = 0;
+                while (true)
                 {
-                    std::stringstream orig_data;
-                    ar_for_cur->extract_file(path, orig_data);
-
-                    char buf0[1024];
-                    char buf1[1024];
-                    std::streamsize buf0_read = 0;
-                    std::streamsize buf1_read = 0;
-                    while (true)
-                    {
-                        file_data.read(buf0, sizeof(buf0));
-                        buf0_read = file_data.gcount();
-
-                        orig_data.read(buf1, sizeof(buf1));
-                        buf1_read = file_data.gcount();
+                    file_data.read(buf0, sizeof(buf0));
+                    buf0_read = file_data.gcount();
 
-                        if (file_data.eof() != orig_data.eof() || buf0_read != buf1_read)
-                        {
-                            is_different = true;
-                            break;
-                        }
+                    orig_data.read(buf1, sizeof(buf1));
+                    buf1_read = file_data.gcount();
 
-                        assert(buf0_read == buf1_read);
-                        if (memcmp(buf0, buf1, buf0_read) != 0)
-                        {
-                            is_different = true;
-                            break;
-                        }
+                    if (file_data.eof() != orig_data.eof() || buf0_read != buf1_read)
+                    {
+                        is_different = true;
+                        break;
+                    }
 
-                        if (file_data.eof() || orig_data.eof())
-                            break;
+                    assert(buf0_read == buf1_read);
+                    if (memcmp(buf0, buf1, buf0_read) != 0)
+                    {
+                        is_different = true;
+                        break;
                     }
-                }
-                else
-                {
-                    printf("could not open %s", file_dest_path.u8string().c_str());
-                }
 
-                if (is_different)
-                {
-                    printf("changed: %s\n", path.u8string().c_str());
-                    int overwrite_result = prompt_overwrite(path);
-                    if (overwrite_result == 2) // canceled
-                        return;
-                    ignore_file = overwrite_result == 0;
+                    if (file_data.eof() || orig_data.eof())
+                        break;
                 }
             }
-
-            if (ignore_file)
-            {
-                if (std::filesystem::exists(file_dest_path))
-                    ignore_list.emplace(path.native());
-            }
             else
             {
-                std::filesystem::remove(file_dest_path);
-
-                if (path.has_parent_path())
-                    directories.emplace(path.parent_path().native());
+                printf("could not open %s", file_dest_path.u8string().c_str());
             }
-        }
 
-        // remove empty directories
-        for (auto &dir_path : directories)
+            return is_different;
+        }, ignore_list);
+
+        if (!is_done) return;
+    }
+
+    if (_cancel_requested) return; // hmm... seems like a bad idea to cancel here
+    _progress = 0.0f;
+    send_event(InstallEventType::STATUS, util::format("Installing %s...", desired_release.version_name.c_str()));
+    
+    std::filesystem::path install_dir = _rained_dir;
+    if (is_side_by_side)
+        install_dir = side_by_side::begin_install(_rained_dir, desired_release.version_name);
+
+    if (!place_files(install_dir, new_files, ignore_list)) return; // hmm... seems like a bad idea to cancel here
+
+    if (is_side_by_side)
+    {
+        side_by_side::finish_install(_rained_dir, desired_release.version_name);
+        side_by_side::activate(_rained_dir, desired_release.version_name);
+    }
+
+    save_current_archive(new_release_archive);
+    store::record_installed(desired_release.version_name, new_files, active_install_time(_rained_dir, desired_release.version_name));
+
+    // so rained doesn't need to be started to find out what was just installed
+    installed::record_version(side_by_side::active_dir(_rained_dir), desired_release.version_name);
+    _installed_version = desired_release.version_name;
+}
+
+bool InstallTask::place_files(const std::filesystem::path &install_dir, const std::vector<store::file_entry> &files, const std::unordered_set<std::filesystem::path::string_type> &ignore_list)
+{
+    // side-by-side installs go to a directory of their own
+    bool is_side_by_side = install_dir != _rained_dir;
+
+    int method_counts[4] = {};
+    int files_processed = 0;
+    for (auto &file : files)
+    {
+        files_processed++;
+        if (ignore_list.find(file.path.native()) != ignore_list.end()) continue;
+
+        std::filesystem::path dest_path = install_dir / file.path;
+
+        // settings that are shared between versions are only filled in where
+        // the user doesn't have them yet
+        if (is_side_by_side && side_by_side::is_shared(file.path))
         {
-            std::filesystem::path abs_path = _rained_dir / dir_path;
-            if (std::filesystem::is_directory(abs_path) && std::filesystem::is_empty(abs_path))
-                std::filesystem::remove(abs_path);
+            dest_path = _rained_dir / file.path;
+            if (std::filesystem::exists(std::filesystem::symlink_status(dest_path))) continue;
         }
+
+        store::link_method method = store::materialize(file, dest_path);
+        method_counts[(int)method]++;
+
+        _progress = (float)files_processed / files.size();
+        if (_cancel_requested) return false;
     }
 
+    printf("installed %i files: %i reflinked, %i hard linked, %i copied\n",
+        files_processed, method_counts[(int)store::link_method::reflink],
+        method_counts[(int)store::link_method::hardlink], method_counts[(int)store::link_method::copy]);
+
+    return true;
+}
+
+void InstallTask::_rollback()
+{
+    store::installation previous;
+    if (!store::load_previous(previous))
+        throw std::runtime_error("There is no previous installation to roll back to.");
+
+    _progress = -1.0f;
+    send_event(InstallEventType::STATUS, util::format("Rolling back to %s...", previous.version_name.c_str()));
+
+    store::installation current;
+    bool has_current = store::load_installed(current);
+
+    bool is_side_by_side = side_by_side::enabled();
+    bool needs_files = true;
+    std::filesystem::path install_dir = _rained_dir;
+    std::unordered_set<std::filesystem::path::string_type> ignore_list;
+
+    if (is_side_by_side)
     {
-        std::lock_guard guard(_mutex);
-        if (_cancel_requested) return; // hmm... seems like a bad idea to cancel here
-        _prog_msg = util::format("Installing %s...", desired_release.version_name.c_str());
-        _progress = 0.0f;
+        // the previous version is usually still installed next to this one,
+        // unless it was a nightly that the current one replaced
+        bool is_replaced = has_current && current.version_name == previous.version_name;
+        needs_files = is_replaced || !side_by_side::is_installed(_rained_dir, previous.version_name);
+        if (needs_files)
+            install_dir = side_by_side::begin_install(_rained_dir, previous.version_name);
     }
-    
-    // extract files for the new version
+    else if (has_current)
     {
-        auto ar_for_new = read_archive_for_platform(new_release_archive);
+        std::vector<std::filesystem::path> paths;
+        for (auto &file : current.files)
+            paths.push_back(file.path);
 
-        auto &files = ar_for_new->files();
-        int files_processed = 0;
-        for (auto &path : files)
+        bool is_done = remove_files(paths, [&](size_t index)
         {
-            if (ignore_list.find(path.native()) != ignore_list.end()) continue;
-            ar_for_new->extract_file(path, _rained_dir);
+            return !store::matches(current.files[index], _rained_dir / current.files[index].path);
+        }, ignore_list);
 
-            files_processed++;
+        if (!is_done) return;
+    }
 
-            std::lock_guard guard(_mutex);
-            _progress = (float)files_processed / files.size();
-            if (_cancel_requested) return; // hmm... seems like a bad idea to cancel here
-        }
+    if (needs_files)
+    {
+        _progress = 0.0f;
+        if (!place_files(install_dir, previous.files, ignore_list)) return;
+    }
+
+    if (is_side_by_side)
+    {
+        if (needs_files)
+            side_by_side::finish_install(_rained_dir, previous.version_name);
+
+        side_by_side::activate(_rained_dir, previous.version_name);
     }
 
-    // copy new version to zip for current
-    cur_release_archive = rvm_path / ("rained-current" ARCHIVE_EXT);
-    std::filesystem::copy_file(
-        new_release_archive,
-        cur_release_archive,
-        std::filesystem::copy_options::overwrite_existing
-    );
+    // the archive is only needed to verify the installation, so it isn't
+    // fetched if it is gone. the cached nightly is a newer one. the store
+    // doesn't keep download urls, so only the cache is looked at.
+    ReleaseInfo previous_release {};
+    previous_release.version_name = previous.version_name;
+    sys::file_lock archive_lock;
+    std::filesystem::path archive_path;
+    if (previous.version_name != "Nightly")
+        archive_path = download::lock_cached_release(previous_release, archive_lock, [](const download::progress&) { return true; });
+
+    if (!archive_path.empty())
+        save_current_archive(archive_path);
+    else
+        std::filesystem::remove(download::rainedvm_path() / ("rained-current" ARCHIVE_EXT));
+
+    // the current installation becomes the previous one, so rolling back
+    // again undoes the rollback
+    store::record_installed(previous.version_name, previous.files, active_install_time(_rained_dir, previous.version_name));
+    installed::record_version(side_by_side::active_dir(_rained_dir), previous.version_name);
+    _installed_version = previous.version_name;
 }
 
 InstallTask::~InstallTask()
 {
-    if (_thread.joinable())
-        _thread.join();
+    if (_job.valid())
+        _job.wait();
 }
 
 void Application::install_version(const ReleaseInfo &release)
 {
-    _install_task = std::make_unique<InstallTask>(rained_dir, cur_release_info, release);
+    // hand an in-progress prefetch of the same release over to the install task,
+    // and stop any other one so it doesn't compete for bandwidth
+    std::unique_ptr<PrefetchTask> prefetch;
+    if (_prefetch_task && _prefetch_task->release().version_name == release.version_name)
+        prefetch = std::move(_prefetch_task);
+    _prefetch_task = nullptr;
+
+    _install_task = std::make_unique<InstallTask>(rained_dir, cur_release_info, release, std::move(prefetch));
+    _rollback_result.clear();
+}
+
+void Application::roll_back()
+{
+    _prefetch_task = nullptr;
+    _install_task = InstallTask::rollback(rained_dir);
+    _rollback_result.clear();
+}
+
+void Application::prefetch_version(const ReleaseInfo &release)
+{
+    if (!config::get().prefetch_releases || _install_task)
+        return;
+
+    if (_prefetch_task && _prefetch_task->release().version_name == release.version_name)
+        return;
+
+    // the installed version is already in the cache as rained-current
+    if (release.version_name == cur_release_info.version_name || download::is_release_cached(release))
+    {
+        _prefetch_task = nullptr;
+        return;
+    }
+
+    _prefetch_task = std::make_unique<PrefetchTask>(release);
+}
+
+void Application::prefetch_latest_version()
+{
+    // prefetch the nightly for nightly users, and the newest stable release otherwise
+    bool is_nightly = cur_release_info.version_name == "Nightly";
+    for (size_t i = 0; i < version_count(); i++)
+    {
+        catalog::snapshot::release_view release = _catalog->release(i);
+        if ((release.version_name == "Nightly") == is_nightly)
+        {
+            prefetch_version(release.to_release_info());
+            break;
+        }
+    }
 }
\ No newline at end of file
@@ -2,68 +2,152 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include <filesystem>
 #include <memory>
-#include <thread>
-#include <mutex>
-#include <condition_variable>
-
-struct ReleaseInfo
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <unordered_set>
+#include <optional>
+#include "release.hpp"
+#include "prefetch.hpp"
+#include "catalog.hpp"
+#include "markdown.hpp"
+#include "tasks.hpp"
+#include "spsc_queue.hpp"
+#include "store.hpp"
+#include "cache.hpp"
+
+// sent from the install job to the ui
+enum class InstallEventType
 {
-    std::string version_name;
-    std::string api_url;
-    std::string url;
-    std::string changelog;
-    std::string linux_download_url;
-    std::string windows_download_url;
+    STATUS,
+    DOWNLOAD_STATUS, // a status that should show the retries of the download
+    OVERWRITE_PROMPT,
+    FAULTED,
+    FINISHED
 };
 
-struct OverwritePromptInfo
+struct InstallEvent
 {
-    std::string display_file_path;
-    int user_input;
-    std::shared_ptr<std::condition_variable> cv;
+    InstallEventType type;
+    std::string text; // status, path to prompt for, or error message
 };
 
 class InstallTask
 {
 private:
-    std::thread _thread;
-    std::mutex _mutex;
+    std::future<void> _job;
     std::filesystem::path _rained_dir;
-    std::unique_ptr<OverwritePromptInfo> _overwrite_prompt;
-
-    std::string _prog_msg;
-    float _progress;
-    bool _cancel_requested;
-
-    bool _thread_faulted;
-    std::string _thread_exception;
-
-    bool _is_thread_done;
+    std::unique_ptr<PrefetchTask> _prefetch;
+
+    // written by the job, read by the ui without locking
+    util::spsc_queue<InstallEvent, 32> _events;
+    std::atomic<float> _progress;
+    std::atomic<int> _download_retries;
+    std::atomic<int> _download_stalls;
+    std::atomic<bool> _download_waiting;
+
+    // written by the ui, read by the job
+    std::atomic<bool> _cancel_requested;
+    std::atomic<int> _prompt_result;
+
+    // ui state, built from the events by poll_events
+    std::string _status;
+    bool _is_download_status;
+    std::string _prompt_path;
+    bool _has_prompt;
+    std::string _exception;
+    bool _is_faulted;
+    bool _is_done;
+
+    // written by the job before it finishes
+    std::string _installed_version;
+    std::chrono::milliseconds _elapsed;
 
     const ReleaseInfo cur_release;
     const ReleaseInfo desired_release;
+    const bool _is_rollback;
+
+    InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release, std::unique_ptr<PrefetchTask> prefetch, bool is_rollback);
 
     void _thread_proc();
     void _install();
+    void _rollback();
 
+    void send_event(InstallEventType type, std::string text);
     int prompt_overwrite(const std::filesystem::path &file_path);
+
+    // put the files in install_dir, linking them to the store where possible,
+    // except the ones in ignore_list. returns false if canceled.
+    bool place_files(const std::filesystem::path &install_dir, const std::vector<store::file_entry> &files, const std::unordered_set<std::filesystem::path::string_type> &ignore_list);
+
+    // remove the files of the installed version, asking about the ones that
+    // is_changed says the user changed. the files that are kept are added to
+    // ignore_list. returns false if canceled.
+    bool remove_files(const std::vector<std::filesystem::path> &files, const std::function<bool(size_t)> &is_changed, std::unordered_set<std::filesystem::path::string_type> &ignore_list);
     
 public:
     InstallTask(const InstallTask&) = delete;
     InstallTask& operator=(InstallTask const&) = delete;
-    InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release);
+    InstallTask(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &desired_release, std::unique_ptr<PrefetchTask> prefetch = nullptr);
     ~InstallTask();
 
+    /**
+    * Restore the installation that the last install replaced, from the store.
+    * Nothing is downloaded or extracted.
+    **/
+    static std::unique_ptr<InstallTask> rollback(const std::filesystem::path &rained_dir);
+
+    /**
+    * Apply the events sent by the job since the last call. The functions
+    * below only return what was applied here, so call this once per frame,
+    * on the ui thread.
+    **/
+    void poll_events();
+
     // returns true if still processing, false if done.
-    bool get_progress(std::string &out_msg, float &out_progress);
-    bool get_exception(std::string &out_except);
-    bool get_overwrite_prompt(OverwritePromptInfo &out_prompt_info) const;
+    bool get_progress(float &out_progress) const;
+    const std::string& status() const { return _status; }
+
+    bool is_faulted() const { return _is_faulted; }
+    const std::string& exception() const { return _exception; }
+
+    // returns true if the current status is a download with retries to show
+    bool get_download_stats(int &out_retries, int &out_stalls, bool &out_waiting) const;
+
+    // returns the path of a file with local changes that the job is waiting on
+    const std::string* get_overwrite_prompt() const;
     void set_overwrite_prompt_result(int condition);
     void cancel();
+
+    // once done, the version that was installed, which is empty if the
+    // job was canceled, and how long the job took
+    const std::string& installed_version() const { return _installed_version; }
+    bool is_rollback() const { return _is_rollback; }
+    std::chrono::milliseconds elapsed() const { return _elapsed; }
 }; // class InstallTask
 
+/**
+* The installed Rained version, and the release list if it was requested.
+**/
+struct VersionQueryResult
+{
+    bool is_rained_installed;
+    std::string current_version;
+
+    // null if the release list wasn't requested
+    std::shared_ptr<const catalog::snapshot> catalog;
+
+    // true if the release list came from the cache and should be revalidated
+    bool from_cache;
+
+    // the version that rolling back would restore, or empty if there is none
+    std::string rollback_version;
+};
+
 class Application
 {
 private:
@@ -74,20 +158,64 @@ private:
         CHOOSE_VERSION
     } cur_state;
 
-    unsigned int frame;
     std::filesystem::path rained_dir;
     std::string current_version;
-    std::vector<ReleaseInfo> available_versions;
 
     bool is_rained_installed;
     ReleaseInfo cur_release_info;
     std::unique_ptr<InstallTask> _install_task;
+    std::unique_ptr<PrefetchTask> _prefetch_task;
+
+    // label of the rollback button, empty if there is nothing to roll back to,
+    // and the outcome of the last rollback
+    std::string _rollback_label;
+    std::string _rollback_result;
+
+    // set to abort background work when the application closes
+    tasks::cancel_token _closing;
+
+    // the release list. the ui reads it straight out of the snapshot, which
+    // is shared with the job that revalidates it.
+    std::shared_ptr<const catalog::snapshot> _catalog;
+    std::future<std::shared_ptr<const catalog::snapshot>> _catalog_refresh;
+    std::future<void> _catalog_save;
+
+    // shown in the settings menu. gathering them reads the cache index, so
+    // it is done in the background when the menu opens and after an install.
+    std::optional<cache::stats> _cache_stats;
+    std::future<cache::stats> _cache_stats_query;
+    bool _settings_menu_open = false;
+
+    tasks::cancel_token _version_query_cancel;
+    std::future<VersionQueryResult> _version_query;
+
+    // parsed changelogs, by version name
+    std::map<std::string, markdown::document> _changelogs;
+
+    // label of the installed version in the version list, lowercase names
+    // of the versions in the snapshot, and the indices of the versions that
+    // match the search box
+    std::string _current_label;
+    std::vector<std::string> _version_search_index;
+    std::vector<int> _filtered_versions;
+    char _version_filter[64] = {};
 
     int selected_version;
     bool about_window_open = false;
 
     void install_version(const ReleaseInfo &release_info);
-    bool query_current_version();
+    void roll_back();
+    void prefetch_version(const ReleaseInfo &release_info);
+    void prefetch_latest_version();
+    void start_version_query(bool need_catalog);
+    void poll_version_query();
+    size_t version_count() const;
+    void select_current_release();
+    void rebuild_version_list();
+    void filter_version_list();
+    void poll_catalog_refresh();
+    void refresh_cache_stats();
+    void poll_cache_stats();
 
 public:
     Application(const Application&) = delete;
@@ -97,4 +225,10 @@ public:
     ~Application();
 
     void render_main_window();
+
+    /**
+    * Returns true if the window changes even without input, so the main loop
+    * shouldn't go idle.
+    **/
+    bool is_animating() const;
 }; // class Application
\ No newline at end of file
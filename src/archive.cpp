@@ -3,11 +3,14 @@
 #include <mz_strm.h>
 #include <mz_strm_os.h>
 #include <mz_zip_rw.h>
+#include <zlib.h>
 #include <chrono>
 #include <sstream>
+#include <fstream>
+#include <iterator>
+#include <cstring>
 #include "archive.hpp"
 #include "sys.hpp"
-#include "util.hpp"
 
 archive::basic_archive::basic_archive(const std::filesystem::path &archive_path) :
     archive_path(archive_path)
@@ -141,7 +144,9 @@ archive::tar_archive::tar_archive(const std::filesystem::path &tar_path, bool is
     p_impl->is_temporary = is_temporary;
 
     std::stringstream dir_list;
-    if (sys::subprocess(util::format("tar -tf \"%s\"", tar_path.u8string().c_str()), dir_list) != 0)
+    sys::spawn_options options;
+    options.on_output = [&](const char *data, size_t size) { dir_list.write(data, size); };
+    if (sys::spawn({ "tar", "-tf", tar_path.u8string() }, options) != 0)
         throw archive::archive_exception("could not read archive directory");
 
     std::string line;
@@ -178,9 +183,8 @@ archive::tar_archive archive::tar_archive::from_gzipped(std::filesystem::path ta
 
     std::filesystem::path tar_path = std::filesystem::temp_directory_path() / filename;
 
-    std::string cmd = util::format("gzip -dk \"%s\"", tar_gz_path.u8string().c_str());
-    if (sys::subprocess(cmd.c_str()) != 0)
-        throw std::runtime_error("failed to run command: " + cmd);
+    if (sys::spawn({ "gzip", "-dk", tar_gz_path.u8string() }) != 0)
+        throw std::runtime_error("failed to decompress " + tar_gz_path.u8string());
 
     std::filesystem::path in_tar_path = tar_gz_path.replace_extension(); // removed gz extension
     std::filesystem::rename(in_tar_path, tar_path);
@@ -195,21 +199,506 @@ const std::vector<std::filesystem::path>& archive::tar_archive::files()
 
 void archive::tar_archive::extract_file(const std::filesystem::path &entry_path, const std::filesystem::path &dest_dir)
 {
-    std::string cmd = util::format("tar -C \"%s\" -xf \"%s\" \"%s\"", dest_dir.u8string().c_str(), archive_path.u8string().c_str(), entry_path.u8string().c_str());
-    if (sys::subprocess(cmd) != 0)
+    // "--" so that an entry starting with a dash isn't taken as an option
+    if (sys::spawn({ "tar", "-C", dest_dir.u8string(), "-xf", archive_path.u8string(), "--", entry_path.u8string() }) != 0)
         throw archive::archive_exception("failed to extract file");
 }
 
 void archive::tar_archive::extract_file(const std::filesystem::path &entry_path, std::ostream &dest_stream)
 {
-    std::string cmd = util::format("tar -xOf \"%s\" \"%s\"", archive_path.u8string().c_str(), entry_path.u8string().c_str());
-    if (sys::subprocess(cmd, dest_stream) != 0)
+    sys::spawn_options options;
+    options.on_output = [&](const char *data, size_t size) { dest_stream.write(data, size); };
+    if (sys::spawn({ "tar", "-xOf", archive_path.u8string(), "--", entry_path.u8string() }, options) != 0)
         throw archive::archive_exception("failed to extract file");
 }
 
 void archive::tar_archive::extract_all(const std::filesystem::path &dest_dir)
 {
-    std::string cmd = util::format("tar -C \"%s\" -xf \"%s\"", dest_dir.u8string().c_str(), archive_path.u8string().c_str());
-    if (sys::subprocess(cmd) != 0)
+    if (sys::spawn({ "tar", "-C", dest_dir.u8string(), "-xf", archive_path.u8string() }) != 0)
         throw archive::archive_exception("failed to extract archive");
-}
\ No newline at end of file
+}
+
+
+
+
+
+
+////////////////////
+// gzip streaming //
+////////////////////
+struct archive::gzip_stream::impl
+{
+    z_stream strm;
+    std::function<void(const char *data, size_t size)> output;
+    std::vector<char> out_buf;
+    bool member_done; // reached the end of a gzip member
+    int members; // number of fully decompressed members
+    bool trailing; // junk after the last member, which gzip also ignores
+}; // struct archive::gzip_stream::impl
+
+archive::gzip_stream::gzip_stream(std::function<void(const char *data, size_t size)> output) :
+    p_impl(new impl)
+{
+    memset(&p_impl->strm, 0, sizeof(p_impl->strm));
+    p_impl->output = output;
+    p_impl->out_buf.resize(65536);
+    p_impl->member_done = false;
+    p_impl->members = 0;
+    p_impl->trailing = false;
+
+    // 15 + 32: max window size, and auto-detect the gzip header
+    if (inflateInit2(&p_impl->strm, 15 + 32) != Z_OK)
+    {
+        delete p_impl;
+        throw archive::archive_exception("could not initialize zlib");
+    }
+}
+
+archive::gzip_stream::~gzip_stream()
+{
+    inflateEnd(&p_impl->strm);
+    delete p_impl;
+}
+
+void archive::gzip_stream::write(const char *data, size_t size)
+{
+    if (p_impl->trailing) return;
+
+    z_stream &strm = p_impl->strm;
+    strm.next_in = (Bytef *)data;
+    strm.avail_in = (uInt)size;
+
+    do
+    {
+        if (p_impl->member_done)
+        {
+            if (strm.avail_in == 0) break;
+
+            // another gzip member is concatenated after the previous one
+            inflateReset(&strm);
+            p_impl->member_done = false;
+        }
+
+        strm.next_out = (Bytef *)p_impl->out_buf.data();
+        strm.avail_out = (uInt)p_impl->out_buf.size();
+
+        int err = inflate(&strm, Z_NO_FLUSH);
+        size_t have = p_impl->out_buf.size() - strm.avail_out;
+
+        if (err == Z_STREAM_END)
+        {
+            p_impl->member_done = true;
+            p_impl->members++;
+        }
+        else if (err == Z_DATA_ERROR && p_impl->members > 0 && strm.total_out == 0)
+        {
+            // not a gzip header after a complete member; ignore the rest
+            p_impl->trailing = true;
+            return;
+        }
+        else if (err != Z_OK && err != Z_BUF_ERROR)
+        {
+            throw archive::archive_exception("gzip stream is corrupt");
+        }
+
+        if (have > 0)
+            p_impl->output(p_impl->out_buf.data(), have);
+    } while (strm.avail_in > 0 || strm.avail_out == 0);
+}
+
+void archive::gzip_stream::finish()
+{
+    if (!p_impl->member_done && !p_impl->trailing)
+        throw archive::archive_exception("unexpected end of gzip stream");
+}
+
+
+
+
+
+
+////////////////////
+// .tar streaming //
+////////////////////
+namespace
+{
+    enum class tar_entry_kind
+    {
+        skip,
+        file,
+        long_name, // GNU 'L' entry: data is the name of the next entry
+        long_link, // GNU 'K' entry: data is the link target of the next entry
+        pax_header // pax 'x' entry: data is a list of key=value records
+    };
+}
+
+struct archive::tar_stream_extractor::impl
+{
+    std::filesystem::path dest_dir;
+    std::vector<std::filesystem::path> entries;
+
+    char header[512];
+    size_t header_len;
+
+    tar_entry_kind kind;
+    uint64_t data_remaining;
+    uint64_t padding_remaining;
+    std::ofstream file;
+    std::filesystem::path file_path;
+    unsigned int file_mode;
+    std::string meta_data;
+
+    // overrides for the next entry, from GNU long names or pax headers
+    std::string next_name;
+    std::string next_link;
+
+    int zero_blocks;
+
+    void begin_entry();
+    void end_entry();
+    std::filesystem::path safe_dest_path(const std::string &name);
+    void check_link_target(const std::string &name, const std::string &link);
+}; // struct archive::tar_stream_extractor::impl
+
+static uint64_t tar_parse_number(const char *field, size_t size)
+{
+    // base-256 encoding, used by GNU tar for large values
+    if ((unsigned char)field[0] & 0x80)
+    {
+        uint64_t v = (unsigned char)field[0] & 0x7F;
+        for (size_t i = 1; i < size; i++)
+            v = (v << 8) | (unsigned char)field[i];
+        return v;
+    }
+
+    // octal, terminated by space or null
+    uint64_t v = 0;
+    size_t i = 0;
+    while (i < size && field[i] == ' ') i++;
+    for (; i < size && field[i] >= '0' && field[i] <= '7'; i++)
+        v = (v << 3) | (field[i] - '0');
+    return v;
+}
+
+static std::string tar_field_string(const char *field, size_t size)
+{
+    return std::string(field, strnlen(field, size));
+}
+
+std::filesystem::path archive::tar_stream_extractor::impl::safe_dest_path(const std::string &name)
+{
+    std::filesystem::path rel = std::filesystem::u8path(name);
+    if (rel.is_absolute() || rel.has_root_name())
+        throw archive::archive_exception("tar entry has an absolute path: " + name);
+
+    for (auto &part : rel)
+    {
+        if (part == "..")
+            throw archive::archive_exception("tar entry escapes destination: " + name);
+    }
+
+    // a symbolic link extracted earlier could lead anywhere, so nothing is
+    // written through one
+    std::filesystem::path dest_path = dest_dir;
+    for (auto it = rel.begin(); it != rel.end(); it++)
+    {
+        if (std::next(it) == rel.end())
+            break;
+
+        dest_path /= *it;
+        std::error_code ec;
+        if (std::filesystem::is_symlink(std::filesystem::symlink_status(dest_path, ec)))
+            throw archive::archive_exception("tar entry is inside a symbolic link: " + name);
+    }
+
+    return dest_dir / rel;
+}
+
+void archive::tar_stream_extractor::impl::check_link_target(const std::string &name, const std::string &link)
+{
+    std::filesystem::path target = std::filesystem::u8path(link);
+    if (target.is_absolute() || target.has_root_name())
+        throw archive::archive_exception("tar entry links to an absolute path: " + name);
+
+    // relative to the directory of the link
+    std::filesystem::path resolved = (std::filesystem::u8path(name).parent_path() / target).lexically_normal();
+    if (!resolved.empty() && *resolved.begin() == "..")
+        throw archive::archive_exception("tar entry links outside of destination: " + name);
+}
+
+void archive::tar_stream_extractor::impl::begin_entry()
+{
+    uint64_t size = tar_parse_number(header + 124, 12);
+    char type = header[156];
+
+    data_remaining = size;
+    padding_remaining = (512 - size % 512) % 512;
+    kind = tar_entry_kind::skip;
+
+    if (type == 'L' || type == 'K' || type == 'x')
+    {
+        if (type == 'L') kind = tar_entry_kind::long_name;
+        else if (type == 'K') kind = tar_entry_kind::long_link;
+        else kind = tar_entry_kind::pax_header;
+
+        meta_data.clear();
+        return;
+    }
+
+    // global pax headers and other metadata entries don't describe a file
+    if (type == 'g' || type == 'V' || type == 'N')
+        return;
+
+    std::string name;
+    if (!next_name.empty())
+    {
+        name = next_name;
+    }
+    else
+    {
+        name = tar_field_string(header, 100);
+
+        // posix ustar splits long names into a prefix and a name. the old gnu
+        // format uses the prefix area for other things, so check the magic.
+        if (memcmp(header + 257, "ustar\0", 6) == 0)
+        {
+            std::string prefix = tar_field_string(header + 345, 155);
+            if (!prefix.empty())
+                name = prefix + "/" + name;
+        }
+    }
+
+    std::string link = next_link.empty() ? tar_field_string(header + 157, 100) : next_link;
+    next_name.clear();
+    next_link.clear();
+
+    // strip trailing slashes from directory names
+    while (name.size() > 1 && name.back() == '/')
+    {
+        name.pop_back();
+        if (type == '0' || type == '\0') type = '5';
+    }
+
+    if (name.empty() || name == ".")
+        return;
+
+    std::filesystem::path dest_path = safe_dest_path(name);
+    unsigned int mode = (unsigned int)tar_parse_number(header + 100, 8);
+
+    switch (type)
+    {
+        case '5': // directory
+            std::filesystem::create_directories(dest_path);
+            break;
+
+        case '0':
+        case '\0':
+        case '7': // contiguous file, treated as a regular file
+        {
+            std::filesystem::create_directories(dest_path.parent_path());
+
+            // replace a link of the same name instead of writing to its target
+            if (std::filesystem::is_symlink(std::filesystem::symlink_status(dest_path)))
+                std::filesystem::remove(dest_path);
+
+            file.open(dest_path, std::ios::binary | std::ios::trunc);
+            if (!file.is_open())
+                throw archive::archive_exception("could not write to file");
+
+            kind = tar_entry_kind::file;
+            file_path = dest_path;
+            file_mode = mode;
+            entries.push_back(std::filesystem::u8path(name));
+            break;
+        }
+
+        case '2': // symbolic link
+        {
+            check_link_target(name, link);
+            std::filesystem::create_directories(dest_path.parent_path());
+            std::filesystem::remove(dest_path);
+            std::filesystem::create_symlink(std::filesystem::u8path(link), dest_path);
+            entries.push_back(std::filesystem::u8path(name));
+            break;
+        }
+
+        case '1': // hard link to an entry extracted earlier
+        {
+            std::filesystem::create_directories(dest_path.parent_path());
+            std::filesystem::copy_file(safe_dest_path(link), dest_path, std::filesystem::copy_options::overwrite_existing);
+            entries.push_back(std::filesystem::u8path(name));
+            break;
+        }
+
+        default:
+            printf("tar: skipping entry %s of type %c\n", name.c_str(), type);
+            break;
+    }
+
+    if (data_remaining == 0)
+        end_entry();
+}
+
+void archive::tar_stream_extractor::impl::end_entry()
+{
+    switch (kind)
+    {
+        case tar_entry_kind::file:
+            file.close();
+            if (file.fail())
+                throw archive::archive_exception("could not write to file");
+
+            std::filesystem::permissions(file_path, (std::filesystem::perms)(file_mode & 0777));
+            break;
+
+        case tar_entry_kind::long_name:
+            next_name = std::string(meta_data.c_str());
+            break;
+
+        case tar_entry_kind::long_link:
+            next_link = std::string(meta_data.c_str());
+            break;
+
+        case tar_entry_kind::pax_header:
+        {
+            // records are formatted as "<length> <key>=<value>\n"
+            size_t pos = 0;
+            while (pos < meta_data.size())
+            {
+                size_t space = meta_data.find(' ', pos);
+                if (space == std::string::npos) break;
+
+                size_t len = std::strtoul(meta_data.c_str() + pos, nullptr, 10);
+                if (len == 0 || pos + len > meta_data.size()) break;
+
+                std::string record = meta_data.substr(space + 1, pos + len - space - 2);
+                size_t eq = record.find('=');
+                if (eq != std::string::npos)
+                {
+                    std::string key = record.substr(0, eq);
+                    if (key == "path") next_name = record.substr(eq + 1);
+                    else if (key == "linkpath") next_link = record.substr(eq + 1);
+                }
+
+                pos += len;
+            }
+            break;
+        }
+
+        case tar_entry_kind::skip:
+            break;
+    }
+
+    kind = tar_entry_kind::skip;
+}
+
+archive::tar_stream_extractor::tar_stream_extractor(const std::filesystem::path &dest_dir) :
+    p_impl(new impl)
+{
+    p_impl->dest_dir = dest_dir;
+    p_impl->header_len = 0;
+    p_impl->kind = tar_entry_kind::skip;
+    p_impl->data_remaining = 0;
+    p_impl->padding_remaining = 0;
+    p_impl->file_mode = 0;
+    p_impl->zero_blocks = 0;
+}
+
+archive::tar_stream_extractor::~tar_stream_extractor()
+{
+    delete p_impl;
+}
+
+void archive::tar_stream_extractor::write(const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        // two zero blocks mark the end of the archive; ignore anything after
+        if (p_impl->zero_blocks >= 2)
+            return;
+
+        if (p_impl->data_remaining > 0)
+        {
+            size_t count = (size_t)std::min<uint64_t>(size, p_impl->data_remaining);
+
+            if (p_impl->kind == tar_entry_kind::file)
+                p_impl->file.write(data, count);
+            else if (p_impl->kind != tar_entry_kind::skip)
+                p_impl->meta_data.append(data, count);
+
+            data += count;
+            size -= count;
+            p_impl->data_remaining -= count;
+
+            if (p_impl->data_remaining == 0)
+                p_impl->end_entry();
+        }
+        else if (p_impl->padding_remaining > 0)
+        {
+            size_t count = (size_t)std::min<uint64_t>(size, p_impl->padding_remaining);
+            data += count;
+            size -= count;
+            p_impl->padding_remaining -= count;
+        }
+        else
+        {
+            size_t count = std::min(size, sizeof(p_impl->header) - p_impl->header_len);
+            memcpy(p_impl->header + p_impl->header_len, data, count);
+            data += count;
+            size -= count;
+            p_impl->header_len += count;
+
+            if (p_impl->header_len < sizeof(p_impl->header))
+                continue;
+
+            p_impl->header_len = 0;
+
+            bool is_zero = true;
+            for (char c : p_impl->header)
+            {
+                if (c != 0)
+                {
+                    is_zero = false;
+                    break;
+                }
+            }
+
+            if (is_zero)
+            {
+                p_impl->zero_blocks++;
+                continue;
+            }
+
+            p_impl->zero_blocks = 0;
+            p_impl->begin_entry();
+        }
+    }
+}
+
+void archive::tar_stream_extractor::finish()
+{
+    if (p_impl->data_remaining > 0 || p_impl->header_len > 0)
+        throw archive::archive_exception("unexpected end of tar stream");
+}
+
+const std::vector<std::filesystem::path>& archive::tar_stream_extractor::files() const
+{
+    return p_impl->entries;
+}
+
+std::unique_ptr<archive::basic_archive> archive::open_release_archive(const std::filesystem::path &archive_path)
+{
+#ifdef _WIN32
+    return std::make_unique<archive::zip_archive>(archive_path);
+#elif defined(__linux__)
+    return std::make_unique<archive::tar_archive>(archive::tar_archive::from_gzipped(archive_path));
+#else
+    #error archive type for current platform is undefined
+#endif
+}
+
+std::string archive::archive_key(const std::filesystem::path &archive_path)
+{
+    return std::to_string(std::filesystem::file_size(archive_path)) + "-" +
+        std::to_string((int64_t) std::filesystem::last_write_time(archive_path).time_since_epoch().count());
+}
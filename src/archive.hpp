@@ -1,8 +1,11 @@
 #pragma once
 
 #include <filesystem>
+#include <string>
 #include <vector>
 #include <ostream>
+#include <functional>
+#include <memory>
 
 namespace archive
 {
@@ -91,4 +94,71 @@ namespace archive
         void extract_file(const std::filesystem::path &entry_path, std::ostream &dest_stream) override;
         void extract_all(const std::filesystem::path &dest_dir) override;
     }; // class gzip_archive
+
+    /**
+    * Incremental gzip decompressor. Compressed bytes are fed in with write(),
+    * and decompressed bytes are passed to the output callback as soon as they
+    * are available.
+    **/
+    class gzip_stream
+    {
+    private:
+        struct impl;
+        impl *p_impl;
+    public:
+        gzip_stream(const gzip_stream&) = delete;
+        gzip_stream& operator=(gzip_stream const&) = delete;
+
+        gzip_stream(std::function<void(const char *data, size_t size)> output);
+        ~gzip_stream();
+
+        void write(const char *data, size_t size);
+
+        /**
+        * Throws if the compressed stream ended prematurely.
+        **/
+        void finish();
+    }; // class gzip_stream
+
+    /**
+    * Extracts a .tar stream into a destination directory while bytes are
+    * fed in, without needing the whole archive to be present.
+    **/
+    class tar_stream_extractor
+    {
+    private:
+        struct impl;
+        impl *p_impl;
+    public:
+        tar_stream_extractor(const tar_stream_extractor&) = delete;
+        tar_stream_extractor& operator=(tar_stream_extractor const&) = delete;
+
+        tar_stream_extractor(const std::filesystem::path &dest_dir);
+        ~tar_stream_extractor();
+
+        void write(const char *data, size_t size);
+
+        /**
+        * Throws if the stream ended in the middle of an entry.
+        **/
+        void finish();
+
+        /**
+        * Get a list of all non-directory entries extracted so far.
+        **/
+        const std::vector<std::filesystem::path>& files() const;
+    }; // class tar_stream_extractor
+
+    /**
+    * Open a release archive in the format used on this platform: .zip on
+    * Windows, .tar.gz on Linux.
+    **/
+    std::unique_ptr<basic_archive> open_release_archive(const std::filesystem::path &archive_path);
+
+    /**
+    * Identify an archive file by its size and modification time, without
+    * reading it. Indexes built from an archive keep this to notice when
+    * the archive was replaced.
+    **/
+    std::string archive_key(const std::filesystem::path &archive_path);
 } // namespace archive
\ No newline at end of file
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace util
+{
+    /**
+    * Fixed-capacity blocking queue for handing data from one thread to another.
+    * push() blocks while the queue is full and pop() blocks while it is empty.
+    * Once the queue is closed, push() fails and pop() drains what is left.
+    **/
+    template <typename T>
+    class bounded_queue
+    {
+    private:
+        std::mutex _mutex;
+        std::condition_variable _not_full;
+        std::condition_variable _not_empty;
+        std::deque<T> _items;
+        size_t _capacity;
+        bool _closed;
+
+    public:
+        bounded_queue(const bounded_queue&) = delete;
+        bounded_queue& operator=(bounded_queue const&) = delete;
+
+        bounded_queue(size_t capacity) : _capacity(capacity), _closed(false)
+        {}
+
+        /**
+        * Returns false if the queue was closed, in which case the item is dropped.
+        **/
+        bool push(T item)
+        {
+            std::unique_lock lock(_mutex);
+            _not_full.wait(lock, [&]{ return _closed || _items.size() < _capacity; });
+            if (_closed) return false;
+
+            _items.push_back(std::move(item));
+            lock.unlock();
+            _not_empty.notify_one();
+            return true;
+        }
+
+        /**
+        * Returns false once the queue is closed and empty.
+        **/
+        bool pop(T &out_item)
+        {
+            std::unique_lock lock(_mutex);
+            _not_empty.wait(lock, [&]{ return _closed || !_items.empty(); });
+            if (_items.empty()) return false;
+
+            out_item = std::move(_items.front());
+            _items.pop_front();
+            lock.unlock();
+            _not_full.notify_one();
+            return true;
+        }
+
+        void close()
+        {
+            {
+                std::lock_guard lock(_mutex);
+                _closed = true;
+            }
+
+            _not_full.notify_all();
+            _not_empty.notify_all();
+        }
+    }; // class bounded_queue
+} // namespace util
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <vector>
+#include "cache.hpp"
+#include "config.hpp"
+#include "download.hpp"
+#include "store.hpp"
+#include "sys.hpp"
+#include "json.hpp"
+
+using namespace nlohmann;
+
+namespace
+{
+    struct archive_entry
+    {
+        uint64_t size;
+        int64_t last_access; // unix time
+    };
+
+    struct cache_index
+    {
+        // by file name
+        std::map<std::string, archive_entry> archives;
+
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t bytes_saved = 0;
+    };
+}
+
+// downloads and installs run on other threads than the ui
+static std::mutex index_mutex;
+static cache_index cur_index;
+
+static std::filesystem::path index_path()
+{
+    return download::cache_path() / "cache.json";
+}
+
+static int64_t unix_time(std::chrono::system_clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(time.time_since_epoch()).count();
+}
+
+// cached archives are named rained-<version><ext>. rained-current is a copy
+// of the installed one, not part of the cache.
+static bool archive_version(const std::string &file_name, std::string &out_version)
+{
+    const std::string prefix = "rained-";
+    const std::string ext = ARCHIVE_EXT;
+
+    if (file_name.size() <= prefix.size() + ext.size() ||
+        file_name.compare(0, prefix.size(), prefix) != 0 ||
+        file_name.compare(file_name.size() - ext.size(), ext.size(), ext) != 0)
+    {
+        return false;
+    }
+
+    out_version = file_name.substr(prefix.size(), file_name.size() - prefix.size() - ext.size());
+    return out_version != "current";
+}
+
+// pick up archives that were added or deleted behind the index's back, like
+// the ones from before it existed. an archive that the index doesn't know
+// was last used when it was written.
+static void sync_index()
+{
+    std::map<std::string, archive_entry> archives;
+
+    std::error_code ec;
+    for (auto &dir_entry : std::filesystem::directory_iterator(download::cache_path(), ec))
+    {
+        std::string file_name = dir_entry.path().filename().u8string();
+        std::string version;
+        if (!archive_version(file_name, version) || !dir_entry.is_regular_file(ec))
+            continue;
+
+        archive_entry entry;
+        entry.size = dir_entry.file_size(ec);
+
+        auto old_entry = cur_index.archives.find(file_name);
+        if (old_entry != cur_index.archives.end())
+        {
+            entry.last_access = old_entry->second.last_access;
+        }
+        else
+        {
+            auto age = std::filesystem::file_time_type::clock::now() - dir_entry.last_write_time(ec);
+            entry.last_access = unix_time(std::chrono::system_clock::now() - std::chrono::duration_cast<std::chrono::system_clock::duration>(age));
+        }
+
+        archives.emplace(file_name, entry);
+    }
+
+    cur_index.archives = std::move(archives);
+}
+
+static void load_index()
+{
+    cur_index = cache_index();
+
+    std::ifstream stream(index_path());
+    if (stream.is_open())
+    {
+        try
+        {
+            json data = json::parse(stream);
+            cur_index.hits = data.value("hits", (uint64_t)0);
+            cur_index.misses = data.value("misses", (uint64_t)0);
+            cur_index.bytes_saved = data.value("bytes_saved", (uint64_t)0);
+
+            for (auto &[name, archive] : data.at("archives").items())
+                cur_index.archives[name] = { archive.at("size").get<uint64_t>(), archive.at("last_access").get<int64_t>() };
+        }
+        catch (json::exception &e)
+        {
+            fprintf(stderr, "could not parse cache.json: %s\n", e.what());
+        }
+    }
+
+    sync_index();
+}
+
+namespace
+{
+    // held while the index is used. other instances sharing the cache change
+    // it too, so it is read again every time.
+    class index_guard
+    {
+    private:
+        std::lock_guard<std::mutex> _lock;
+        sys::file_lock _file_lock;
+
+    public:
+        index_guard() : _lock(index_mutex)
+        {
+            std::filesystem::path lock_path = index_path();
+            lock_path += ".lock";
+            _file_lock.lock(lock_path);
+
+            load_index();
+        }
+    };
+}
+
+static void save_index()
+{
+    json archives = json::object();
+    for (auto &[name, archive] : cur_index.archives)
+        archives[name] = { { "size", archive.size }, { "last_access", archive.last_access } };
+
+    json data;
+    data["hits"] = cur_index.hits;
+    data["misses"] = cur_index.misses;
+    data["bytes_saved"] = cur_index.bytes_saved;
+    data["archives"] = std::move(archives);
+
+    std::ofstream stream(index_path());
+    stream << data.dump();
+}
+
+static archive_entry& touch(const std::filesystem::path &archive_path)
+{
+    archive_entry &entry = cur_index.archives[archive_path.filename().u8string()];
+
+    std::error_code ec;
+    entry.size = std::filesystem::file_size(archive_path, ec);
+    entry.last_access = unix_time(std::chrono::system_clock::now());
+    return entry;
+}
+
+float cache::stats::hit_rate() const
+{
+    if (hits + misses == 0)
+        return 0.0f;
+
+    return (float)hits / (hits + misses);
+}
+
+void cache::record_hit(const std::filesystem::path &archive_path)
+{
+    index_guard guard;
+
+    archive_entry &entry = touch(archive_path);
+    cur_index.hits++;
+    cur_index.bytes_saved += entry.size;
+    save_index();
+}
+
+void cache::record_miss(const std::filesystem::path &archive_path, uint64_t bytes_saved)
+{
+    index_guard guard;
+
+    touch(archive_path);
+    cur_index.misses++;
+    cur_index.bytes_saved += bytes_saved;
+    save_index();
+}
+
+static uint64_t evict_archives()
+{
+    index_guard guard;
+
+    uint64_t budget = config::get().cache_max_bytes;
+    uint64_t total_size = 0;
+    for (auto &[name, archive] : cur_index.archives)
+        total_size += archive.size;
+
+    if (budget == 0 || total_size <= budget)
+    {
+        save_index();
+        return 0;
+    }
+
+    // what rollback and uninstalling may still need
+    std::set<std::string> pinned;
+    store::installation installation;
+    if (store::load_installed(installation))
+        pinned.insert(installation.version_name);
+    if (store::load_previous(installation))
+        pinned.insert(installation.version_name);
+
+    std::vector<std::pair<std::string, archive_entry>> by_age(cur_index.archives.begin(), cur_index.archives.end());
+    std::sort(by_age.begin(), by_age.end(), [](auto &a, auto &b)
+    {
+        return a.second.last_access < b.second.last_access;
+    });
+
+    uint64_t freed = 0;
+    for (auto &[name, archive] : by_age)
+    {
+        if (total_size <= budget)
+            break;
+
+        std::string version;
+        archive_version(name, version);
+        if (pinned.count(version))
+            continue;
+
+        // an archive is locked while it is downloaded or installed, possibly
+        // by another instance sharing the cache
+        std::filesystem::path archive_path = download::cache_path() / std::filesystem::u8path(name);
+        std::filesystem::path lock_path = archive_path;
+        lock_path += ".lock";
+
+        sys::file_lock archive_lock;
+        if (!archive_lock.try_lock(lock_path))
+            continue;
+
+        std::error_code ec;
+        std::filesystem::remove(archive_path, ec);
+        if (ec)
+            continue;
+
+        printf("cache: evicted %s\n", name.c_str());
+        store::remove_version(version);
+        cur_index.archives.erase(name);
+        total_size -= archive.size;
+        freed += archive.size;
+    }
+
+    save_index();
+    return freed;
+}
+
+uint64_t cache::enforce_budget()
+{
+    uint64_t freed = evict_archives();
+
+    // the store isn't part of the index, so the ui doesn't have to wait for this
+    if (freed > 0)
+        freed += store::collect_garbage();
+
+    return freed;
+}
+
+cache::stats cache::get_stats()
+{
+    index_guard guard;
+
+    stats result;
+    result.hits = cur_index.hits;
+    result.misses = cur_index.misses;
+    result.bytes_saved = cur_index.bytes_saved;
+    result.archive_count = cur_index.archives.size();
+    result.budget = config::get().cache_max_bytes;
+
+    for (auto &[name, archive] : cur_index.archives)
+        result.total_size += archive.size;
+
+    return result;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+
+/**
+* Keeps the release archives in the cache directory, see download::cache_path,
+* within the cache_max_bytes setting. The size and last use of every archive,
+* and how often the cache saved a download, are kept in cache.json next to them.
+* When the archives take up more than the budget, the least recently used ones
+* are deleted, along with their files in the store that no other version needs.
+* The archives of the current and the previous installation are never deleted,
+* and neither are archives locked by a download or an install in progress.
+*
+* With the shared_cache setting, the index is shared by every installation
+* using the cache and is only read and written under a file lock. Only the
+* installation that enforces the budget keeps its archives from being deleted;
+* the others can still uninstall and roll back from their store records.
+**/
+namespace cache
+{
+    struct stats
+    {
+        // requests for an archive that was already cached, and ones that
+        // had to download it, fully or in part
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+
+        // bytes that didn't have to be downloaded thanks to the cache
+        uint64_t bytes_saved = 0;
+
+        size_t archive_count = 0;
+        uint64_t total_size = 0;
+        uint64_t budget = 0; // 0 if unlimited
+
+        float hit_rate() const;
+    };
+
+    /**
+    * An archive was requested and found in the cache.
+    **/
+    void record_hit(const std::filesystem::path &archive_path);
+
+    /**
+    * An archive was downloaded into the cache. bytes_saved are the bytes that
+    * were taken from other cached archives instead, for a delta download.
+    **/
+    void record_miss(const std::filesystem::path &archive_path, uint64_t bytes_saved = 0);
+
+    /**
+    * Delete the least recently used archives until the cache fits in the
+    * budget. Returns the number of bytes freed, including store files.
+    **/
+    uint64_t enforce_budget();
+
+    stats get_stats();
+}
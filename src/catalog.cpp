@@ -0,0 +1,660 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <future>
+#include <optional>
+#include <cpr/cpr.h>
+#include "catalog.hpp"
+#include "catalog_snapshot.hpp"
+#include "config.hpp"
+#include "download.hpp"
+#include "mirror.hpp"
+#include "json.hpp"
+#include "tasks.hpp"
+
+using namespace nlohmann;
+
+namespace
+{
+    enum class fetch_status
+    {
+        ok,
+        not_modified,
+        failed
+    };
+
+    // parses fetched json, returning false if it is invalid
+    typedef std::function<bool(const std::string &text)> parse_callback_t;
+}
+
+static std::filesystem::path cache_path()
+{
+    return download::rainedvm_path() / "catalog.bin";
+}
+
+// sax handler for json.hpp that reads GitHub release objects straight into
+// ReleaseInfo. only the fields that are used are kept; everything else, like
+// the author and reactions objects, is skipped without being stored. parses
+// either a single release or an array of them.
+class release_sax_parser
+{
+private:
+    std::vector<ReleaseInfo> &_releases;
+    const bool _is_list;
+
+    // releases with this tag are dropped
+    const std::string _skip_tag;
+
+    // nesting depth of the current container, and the depth of release objects
+    int _depth = 0;
+    int _release_depth;
+
+    // the last key read. since a key is always followed by its value,
+    // this is the key of whatever value is being read.
+    std::string _key;
+
+    ReleaseInfo _release;
+    std::string _tag;
+    std::string _body;
+    bool _has_assets = false;
+    bool _in_assets = false;
+
+    std::string _content_type;
+    std::string _download_url;
+    std::string _digest;
+    uint64_t _size = 0;
+
+    bool in_release() const { return _depth == _release_depth; }
+    bool in_asset() const { return _in_assets && _depth == _release_depth + 2; }
+
+    bool begin_release()
+    {
+        _release = {};
+        _tag.clear();
+        _body.clear();
+        _has_assets = false;
+        return true;
+    }
+
+    bool end_release()
+    {
+        if (_release.version_name.empty() || _release.api_url.empty() || _release.url.empty() || !_has_assets)
+            return false;
+
+        if (!_skip_tag.empty() && _tag == _skip_tag)
+            return true;
+
+        _release.changelog = std::string("[View on GitHub](") + _release.url + ")\n" + _body;
+        _releases.push_back(std::move(_release));
+        return true;
+    }
+
+    void end_asset()
+    {
+        if (_content_type == "application/x-gzip" || _content_type == "application/gzip")
+        {
+            _release.linux_download_url = _download_url;
+            _release.linux_download_size = _size;
+            _release.linux_download_digest = _digest;
+        }
+        else if (_content_type == "application/x-zip-compressed" || _content_type == "application/zip")
+        {
+            _release.windows_download_url = _download_url;
+            _release.windows_download_size = _size;
+            _release.windows_download_digest = _digest;
+        }
+    }
+
+public:
+    release_sax_parser(std::vector<ReleaseInfo> &out_releases, bool is_list, const std::string &skip_tag) :
+        _releases(out_releases), _is_list(is_list), _skip_tag(skip_tag), _release_depth(is_list ? 2 : 1) {}
+
+    bool null() { return true; }
+    bool boolean(bool) { return true; }
+    bool number_integer(json::number_integer_t) { return true; }
+    bool number_unsigned(json::number_unsigned_t val)
+    {
+        if (in_asset() && _key == "size")
+            _size = val;
+
+        return true;
+    }
+
+    bool number_float(json::number_float_t, const json::string_t&) { return true; }
+    bool binary(json::binary_t&) { return true; }
+
+    bool string(json::string_t &val)
+    {
+        if (in_release())
+        {
+            if (_key == "name") _release.version_name = std::move(val);
+            else if (_key == "url") _release.api_url = std::move(val);
+            else if (_key == "html_url") _release.url = std::move(val);
+            else if (_key == "tag_name") _tag = std::move(val);
+            else if (_key == "body") _body = std::move(val);
+        }
+        else if (in_asset())
+        {
+            if (_key == "content_type") _content_type = std::move(val);
+            else if (_key == "browser_download_url") _download_url = std::move(val);
+            else if (_key == "digest") _digest = std::move(val);
+        }
+
+        return true;
+    }
+
+    bool key(json::string_t &val)
+    {
+        _key = std::move(val);
+        return true;
+    }
+
+    bool start_object(std::size_t)
+    {
+        _depth++;
+
+        // the top level must be what the caller asked for
+        if (_depth == 1 && _is_list)
+            return false;
+
+        if (in_release())
+            return begin_release();
+
+        if (in_asset())
+        {
+            _content_type.clear();
+            _download_url.clear();
+            _digest.clear();
+            _size = 0;
+        }
+
+        return true;
+    }
+
+    bool end_object()
+    {
+        if (in_release() && !end_release())
+            return false;
+
+        if (in_asset())
+            end_asset();
+
+        _depth--;
+        return true;
+    }
+
+    bool start_array(std::size_t)
+    {
+        if (_depth == 0 && !_is_list)
+            return false;
+
+        if (in_release() && _key == "assets")
+        {
+            _has_assets = true;
+            _in_assets = true;
+        }
+
+        _depth++;
+        return true;
+    }
+
+    bool end_array()
+    {
+        _depth--;
+        if (in_release())
+            _in_assets = false;
+
+        return true;
+    }
+
+    bool parse_error(std::size_t position, const std::string&, const detail::exception &e)
+    {
+        fprintf(stderr, "invalid json at %zu: %s\n", position, e.what());
+        return false;
+    }
+};
+
+// parse a release, or a list of releases if is_list is true, and append them to
+// out_releases. releases tagged skip_tag are left out. returns false if the json
+// is invalid or a release is missing a required field.
+static bool parse_releases(const std::string &text, bool is_list, const std::string &skip_tag, std::vector<ReleaseInfo> &out_releases)
+{
+    std::vector<ReleaseInfo> releases;
+    release_sax_parser parser(releases, is_list, skip_tag);
+    if (!json::sax_parse(text, &parser))
+        return false;
+
+    out_releases.insert(out_releases.end(), std::make_move_iterator(releases.begin()), std::make_move_iterator(releases.end()));
+    return true;
+}
+
+// fetch json from a url and pass its text to parse, which returns false if the
+// content is invalid. if etag is not empty, the server is asked to respond with
+// 304 Not Modified if the resource still has that etag. if out_link is given, it
+// receives the Link header of the response. the transfer is aborted once cancel is set.
+static fetch_status fetch_json(const std::string &url, const std::string &etag, parse_callback_t parse, std::string &out_etag, const std::atomic<bool> *cancel, std::string *out_link = nullptr)
+{
+    if (mirror::is_file_url(url))
+    {
+        // the modification time stands in for the etag of a local file
+        std::filesystem::path path = mirror::file_url_path(url);
+        std::error_code ec;
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) return fetch_status::failed;
+
+        out_etag = "mtime-" + std::to_string(mtime.time_since_epoch().count());
+        if (out_etag == etag)
+            return fetch_status::not_modified;
+
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream.is_open())
+            return fetch_status::failed;
+
+        std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+        return parse(text) ? fetch_status::ok : fetch_status::failed;
+    }
+
+    cpr::Header headers;
+    if (!etag.empty())
+        headers["If-None-Match"] = etag;
+
+    cpr::Response r = cpr::Get(
+        cpr::Url(url),
+        cpr::UserAgent(download::USER_AGENT),
+        headers,
+        cpr::ProgressCallback([cancel](cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, cpr::cpr_off_t, intptr_t)
+        {
+            return cancel == nullptr || !*cancel;
+        })
+    );
+
+    printf("status code: %li\n", r.status_code);
+    printf("content type: %s\n", r.header["content-type"].c_str());
+    if (r.status_code == 304)
+    {
+        out_etag = etag;
+        return fetch_status::not_modified;
+    }
+
+    if (r.status_code != 200)
+    {
+        return fetch_status::failed;
+    }
+
+    // a plain http server serving a mirror may not know the content type
+    std::string desired_content_type = "application/json";
+    std::string content_type = r.header["content-type"];
+    if (content_type.substr(0, desired_content_type.length()) != desired_content_type && content_type.substr(0, 10) != "text/plain" && content_type != "application/octet-stream")
+    {
+        return fetch_status::failed;
+    }
+
+    if (!parse(r.text))
+        return fetch_status::failed;
+
+    out_etag = r.header["etag"];
+    if (out_link)
+        *out_link = r.header["link"];
+
+    return fetch_status::ok;
+}
+
+// fetch json from the fastest mirror that responds with valid content. url_for_mirror
+// returns the url of the resource on a mirror with the given base url. the etag of
+// the response is recorded in etags.
+static fetch_status fetch_json_from_mirrors(std::function<std::string(const std::string&)> url_for_mirror, std::map<std::string, std::string> &etags, parse_callback_t parse, const std::atomic<bool> *cancel, std::string *out_link = nullptr)
+{
+    for (auto &base : mirror::ranked())
+    {
+        std::string url = url_for_mirror(base);
+        auto etag_it = etags.find(url);
+        std::string etag;
+
+        fetch_status status = fetch_json(url, etag_it == etags.end() ? "" : etag_it->second, parse, etag, cancel, out_link);
+        if (status != fetch_status::failed)
+        {
+            // forget etags from other mirrors, so that they are not
+            // trusted for data that was fetched from here
+            etags.clear();
+            if (!etag.empty())
+                etags[url] = etag;
+
+            return status;
+        }
+
+        // not the mirror's fault
+        if (cancel && *cancel)
+            break;
+
+        fprintf(stderr, "could not fetch %s\n", url.c_str());
+        mirror::report_failure(base);
+    }
+
+    return fetch_status::failed;
+}
+
+#ifdef DEBUG
+static fetch_status fetch_test_file(const char *path, parse_callback_t parse)
+{
+    std::ifstream stream(path, std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
+    return parse(text) ? fetch_status::ok : fetch_status::failed;
+}
+#endif
+
+// fetch the nightly release. on success, out_releases holds the release.
+static fetch_status fetch_nightly(std::map<std::string, std::string> &etags, std::vector<ReleaseInfo> &out_releases, const std::atomic<bool> *cancel)
+{
+    auto parse = [&](const std::string &text)
+    {
+        out_releases.clear();
+        return parse_releases(text, false, "", out_releases);
+    };
+
+#ifdef DEBUG
+    (void) etags;
+    (void) cancel;
+    return fetch_test_file("nightly.json", parse);
+#else
+    return fetch_json_from_mirrors(mirror::nightly_url, etags, parse, cancel);
+#endif
+}
+
+// GitHub serves at most this many releases per page
+constexpr int RELEASES_PER_PAGE = 100;
+
+// get the url marked with the given rel in a Link header, which looks like
+// <https://api.github.com/...?per_page=100&page=2>; rel="next", <...&page=5>; rel="last"
+static std::string find_link(const std::string &link_header, const std::string &rel)
+{
+    size_t pos = 0;
+    while (true)
+    {
+        size_t open = link_header.find('<', pos);
+        if (open == std::string::npos) break;
+        size_t close = link_header.find('>', open);
+        if (close == std::string::npos) break;
+
+        size_t end = link_header.find(',', close);
+        std::string params = link_header.substr(close + 1, end == std::string::npos ? std::string::npos : end - close - 1);
+        if (params.find("rel=\"" + rel + "\"") != std::string::npos)
+            return link_header.substr(open + 1, close - open - 1);
+
+        if (end == std::string::npos) break;
+        pos = end + 1;
+    }
+
+    return {};
+}
+
+// find the value of the page query parameter in a url
+static size_t find_page_param(const std::string &url)
+{
+    for (const char *key : { "?page=", "&page=" })
+    {
+        size_t pos = url.find(key);
+        if (pos != std::string::npos)
+            return pos + 6;
+    }
+
+    return std::string::npos;
+}
+
+static std::string with_page_number(const std::string &url, int page)
+{
+    size_t pos = find_page_param(url);
+    size_t end = url.find('&', pos);
+    return url.substr(0, pos) + std::to_string(page) + (end == std::string::npos ? "" : url.substr(end));
+}
+
+// fetch the list of versioned releases. on success, out_releases holds the releases.
+static fetch_status fetch_stable(std::map<std::string, std::string> &etags, std::vector<ReleaseInfo> &out_releases, const std::atomic<bool> *cancel)
+{
+    size_t max_releases = (size_t) std::max(1, config::get().max_releases);
+    int per_page = (int) std::min(max_releases, (size_t) RELEASES_PER_PAGE);
+
+    // the nightly release is fetched separately
+    auto parse = [&](const std::string &text)
+    {
+        out_releases.clear();
+        return parse_releases(text, true, "nightly", out_releases);
+    };
+
+    std::string link_header;
+    fetch_status status;
+#ifdef DEBUG
+    status = fetch_test_file("releases.json", parse);
+#else
+    // mirrors serve the whole list at once
+    auto first_page_url = [per_page](const std::string &base)
+    {
+        if (mirror::is_github(base))
+            return mirror::releases_url(base) + "?per_page=" + std::to_string(per_page);
+        return mirror::releases_url(base);
+    };
+
+    // newer releases come first, so the first page changes whenever
+    // anything was released. its etag stands in for the whole list.
+    status = fetch_json_from_mirrors(first_page_url, etags, parse, cancel, &link_header);
+#endif
+
+    if (status != fetch_status::ok)
+    {
+        out_releases.clear();
+        return status;
+    }
+
+    // once the number of the last page is known, fetch the remaining pages at once
+    std::string last_url = find_link(link_header, "last");
+    size_t page_param = find_page_param(last_url);
+    if (page_param != std::string::npos)
+    {
+        int last_page = std::atoi(last_url.c_str() + page_param);
+        int max_pages = (int)((max_releases + per_page - 1) / per_page);
+        last_page = std::min(last_page, max_pages);
+
+        std::vector<std::future<std::optional<std::vector<ReleaseInfo>>>> pages;
+        for (int page = 2; page <= last_page; page++)
+        {
+            pages.push_back(tasks::shared().submit([url = with_page_number(last_url, page), cancel]() -> std::optional<std::vector<ReleaseInfo>>
+            {
+                std::vector<ReleaseInfo> releases;
+                std::string page_etag;
+                auto parse_page = [&](const std::string &text) { return parse_releases(text, true, "nightly", releases); };
+
+                if (fetch_json(url, "", parse_page, page_etag, cancel) != fetch_status::ok)
+                {
+                    fprintf(stderr, "could not fetch %s\n", url.c_str());
+                    return std::nullopt;
+                }
+
+                return releases;
+            }));
+        }
+
+        bool complete = true;
+        for (auto &page : pages)
+        {
+            tasks::shared().wait(page);
+            std::optional<std::vector<ReleaseInfo>> releases = page.get();
+
+            // keep the pages before a missing one, so the list has no holes
+            if (!releases) complete = false;
+            if (complete)
+                out_releases.insert(out_releases.end(), releases->begin(), releases->end());
+        }
+
+        // don't let the etag of the first page vouch for an incomplete list
+        if (!complete)
+        {
+            fprintf(stderr, "could not fetch every page of the release list\n");
+            etags.clear();
+        }
+    }
+
+    if (out_releases.size() > max_releases)
+        out_releases.resize(max_releases);
+
+    return fetch_status::ok;
+}
+
+bool catalog::fetch(release_catalog &catalog, bool &out_changed, const std::atomic<bool> *cancel)
+{
+    printf("update version list\n");
+    out_changed = false;
+
+    std::vector<ReleaseInfo> old_nightly;
+    std::vector<ReleaseInfo> old_stable;
+    for (auto &release : catalog.releases)
+    {
+        if (release.version_name == "Nightly")
+            old_nightly.push_back(release);
+        else
+            old_stable.push_back(release);
+    }
+
+    // conditional requests are only valid if there is something to fall back on
+    std::map<std::string, std::string> nightly_etags;
+    std::map<std::string, std::string> list_etags;
+    if (!old_nightly.empty())
+        nightly_etags = catalog.nightly_etags;
+    if (!old_stable.empty())
+        list_etags = catalog.list_etags;
+
+    // fetch the nightly release and the release list at the same time
+    std::vector<ReleaseInfo> nightly;
+    std::future<fetch_status> nightly_future = tasks::shared().submit([&]()
+    {
+        try { return fetch_nightly(nightly_etags, nightly, cancel); }
+        catch (std::exception &e)
+        {
+            fprintf(stderr, "could not fetch nightly release: %s\n", e.what());
+            return fetch_status::failed;
+        }
+    });
+
+    std::vector<ReleaseInfo> stable;
+    fetch_status stable_status;
+    try { stable_status = fetch_stable(list_etags, stable, cancel); }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "could not fetch release list: %s\n", e.what());
+        stable_status = fetch_status::failed;
+    }
+
+    tasks::shared().wait(nightly_future);
+    fetch_status nightly_status = nightly_future.get();
+    if (cancel && *cancel)
+        return false;
+
+    // a part that failed keeps what was there before, so one failure
+    // doesn't take the other part down with it
+    if (nightly_status == fetch_status::ok)
+    {
+        out_changed = true;
+    }
+    else
+    {
+        if (nightly_status == fetch_status::failed)
+        {
+            fprintf(stderr, "could not fetch nightly release\n");
+            nightly_etags = catalog.nightly_etags;
+        }
+        nightly = std::move(old_nightly);
+    }
+
+    if (stable_status == fetch_status::ok)
+    {
+        out_changed = true;
+    }
+    else
+    {
+        if (stable_status == fetch_status::failed)
+        {
+            fprintf(stderr, "could not fetch release list\n");
+            list_etags = catalog.list_etags;
+        }
+        stable = std::move(old_stable);
+    }
+
+    if (nightly_status == fetch_status::failed && stable_status == fetch_status::failed)
+        return false;
+
+    catalog.releases = std::move(nightly);
+    catalog.releases.insert(catalog.releases.end(), stable.begin(), stable.end());
+    catalog.nightly_etags = std::move(nightly_etags);
+    catalog.list_etags = std::move(list_etags);
+    return !catalog.releases.empty();
+}
+
+std::unique_ptr<catalog::snapshot> catalog::open_cache()
+{
+    auto snap = std::make_unique<snapshot>();
+    if (!snap->open(cache_path()) || snap->release_count() == 0)
+        return nullptr;
+
+    return snap;
+}
+
+bool catalog::load_cache(release_catalog &out_catalog)
+{
+    snapshot snap;
+    if (!snap.open(cache_path()))
+        return false;
+
+    snap.read(out_catalog);
+    return !out_catalog.releases.empty();
+}
+
+// write to a temporary file first, so a crash never leaves a truncated cache,
+// and a snapshot that is mapped somewhere is never modified
+static void replace_cache(const std::function<void(const std::filesystem::path&)> &write)
+{
+    std::filesystem::path tmp_path = cache_path();
+    tmp_path += ".tmp";
+    write(tmp_path);
+
+    // windows may refuse to replace a file another process has mapped. the
+    // cache is only an optimization, so it is left as it is then.
+    std::error_code ec;
+    std::filesystem::rename(tmp_path, cache_path(), ec);
+    if (ec)
+    {
+        fprintf(stderr, "could not replace %s: %s\n", cache_path().u8string().c_str(), ec.message().c_str());
+        std::filesystem::remove(tmp_path, ec);
+    }
+
+    // left over from when the cache was json
+    std::filesystem::remove(download::rainedvm_path() / "catalog.json", ec);
+}
+
+void catalog::save_cache(const release_catalog &catalog)
+{
+    replace_cache([&](const std::filesystem::path &path) { snapshot::write(path, catalog); });
+}
+
+void catalog::save_cache(const snapshot &catalog)
+{
+    replace_cache([&](const std::filesystem::path &path) { catalog.save(path); });
+}
+
+bool catalog::is_release_of(std::string_view version_name, const std::string &version)
+{
+    bool is_nightly = version.find("dev") != std::string::npos || version.find("nightly") != std::string::npos;
+    return version_name == version || (is_nightly && version_name == "Nightly");
+}
+
+int catalog::find_release(const std::vector<ReleaseInfo> &releases, const std::string &version)
+{
+    for (unsigned int i = 0; i < releases.size(); i++)
+    {
+        if (is_release_of(releases[i].version_name, version))
+            return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "release.hpp"
+
+/**
+* The list of available Rained releases, fetched from GitHub or a mirror and
+* cached in .rainedvm so that it can be shown immediately on startup.
+**/
+namespace catalog
+{
+    class snapshot;
+
+    struct release_catalog
+    {
+        // the nightly release, if any, comes first
+        std::vector<ReleaseInfo> releases;
+
+        // ETags of the nightly release and the release list, keyed by
+        // the url they were fetched from
+        std::map<std::string, std::string> nightly_etags;
+        std::map<std::string, std::string> list_etags;
+    };
+
+    /**
+    * Fetch the release list. If the catalog already has releases, conditional
+    * requests are made with its ETags, and only the parts that changed on the
+    * server are replaced. out_changed is set if the releases were modified.
+    *
+    * The nightly release and the release list are fetched concurrently. If only
+    * one of them fails, the catalog keeps its previous entries for that part.
+    * Returns false if neither could be fetched.
+    *
+    * If cancel is given, setting it from another thread aborts the fetch,
+    * which then returns false and leaves the catalog unmodified.
+    **/
+    bool fetch(release_catalog &catalog, bool &out_changed, const std::atomic<bool> *cancel = nullptr);
+
+    /**
+    * Map the catalog saved by save_cache, a snapshot in .rainedvm/catalog.bin.
+    * Returns null if there is none, or it needs to be rebuilt.
+    **/
+    std::unique_ptr<snapshot> open_cache();
+
+    /**
+    * Load a copy of the catalog saved by save_cache. Returns false if there
+    * is none, or it needs to be rebuilt.
+    **/
+    bool load_cache(release_catalog &out_catalog);
+
+    void save_cache(const release_catalog &catalog);
+    void save_cache(const snapshot &catalog);
+
+    /**
+    * Returns true if the release with the given version name is the one an
+    * installed Rained version came from. Development builds match the
+    * nightly release.
+    **/
+    bool is_release_of(std::string_view version_name, const std::string &version);
+
+    /**
+    * Find the release matching an installed Rained version. Development
+    * builds match the nightly release. Returns -1 if there is none.
+    **/
+    int find_release(const std::vector<ReleaseInfo> &releases, const std::string &version);
+}
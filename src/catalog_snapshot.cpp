@@ -0,0 +1,281 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "catalog_snapshot.hpp"
+
+// bump when the layout of the snapshot changes
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+constexpr char SNAPSHOT_MAGIC[8] = { 'R', 'V', 'M', 'C', 'A', 'T', 'L', 'G' };
+
+// written as a native integer; reads back differently on a machine with another byte order
+constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+
+// records are 8-byte aligned, and so is the start of a mapping
+struct catalog::snapshot::string_ref
+{
+    uint32_t offset;
+    uint32_t length;
+};
+
+struct catalog::snapshot::header
+{
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint32_t release_count;
+    uint32_t etag_count;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct catalog::snapshot::release_record
+{
+    string_ref version_name;
+    string_ref api_url;
+    string_ref url;
+    string_ref changelog;
+    string_ref linux_download_url;
+    string_ref windows_download_url;
+    string_ref linux_download_digest;
+    string_ref windows_download_digest;
+    uint64_t linux_download_size;
+    uint64_t windows_download_size;
+};
+
+enum etag_kind : uint32_t
+{
+    ETAG_NIGHTLY = 0,
+    ETAG_LIST = 1
+};
+
+struct catalog::snapshot::etag_record
+{
+    uint32_t kind;
+    uint32_t reserved;
+    string_ref url;
+    string_ref etag;
+};
+
+ReleaseInfo catalog::snapshot::release_view::to_release_info() const
+{
+    ReleaseInfo release {};
+    release.version_name = version_name;
+    release.api_url = api_url;
+    release.url = url;
+    release.changelog = changelog;
+    release.linux_download_url = linux_download_url;
+    release.windows_download_url = windows_download_url;
+    release.linux_download_digest = linux_download_digest;
+    release.windows_download_digest = windows_download_digest;
+    release.linux_download_size = linux_download_size;
+    release.windows_download_size = windows_download_size;
+    return release;
+}
+
+std::string_view catalog::snapshot::get_string(const string_ref &ref) const
+{
+    return std::string_view(_strings + ref.offset, ref.length);
+}
+
+bool catalog::snapshot::open(const std::filesystem::path &path)
+{
+    _header = nullptr;
+    _buffer.clear();
+    if (!_file.open(path))
+        return false;
+
+    return attach(_file.data(), _file.size());
+}
+
+std::unique_ptr<catalog::snapshot> catalog::snapshot::create(const release_catalog &catalog)
+{
+    auto snap = std::make_unique<snapshot>();
+    snap->_buffer = serialize(catalog);
+    if (!snap->attach(snap->_buffer.data(), snap->_buffer.size()))
+        throw std::runtime_error("ERROR: Could not build release catalog snapshot");
+
+    return snap;
+}
+
+bool catalog::snapshot::attach(const uint8_t *data, size_t size)
+{
+    if (size < sizeof(header))
+        return false;
+
+    const header *hdr = (const header*) data;
+    if (memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 || hdr->byte_order != SNAPSHOT_BYTE_ORDER || hdr->version != SNAPSHOT_VERSION)
+        return false;
+
+    // check that everything the records point to is inside the file, so
+    // they can be used afterwards without any checks
+    uint64_t records_end = sizeof(header) + (uint64_t) hdr->release_count * sizeof(release_record) + (uint64_t) hdr->etag_count * sizeof(etag_record);
+    if (records_end > hdr->strings_offset || hdr->strings_offset > size || hdr->strings_size > size - hdr->strings_offset)
+        return false;
+
+    const char *strings = (const char*) (data + hdr->strings_offset);
+    auto ref_ok = [&](const string_ref &ref)
+    {
+        return (uint64_t) ref.offset + ref.length < hdr->strings_size && strings[ref.offset + ref.length] == '\0';
+    };
+
+    const release_record *releases = (const release_record*) (data + sizeof(header));
+    for (uint32_t i = 0; i < hdr->release_count; i++)
+    {
+        const release_record &r = releases[i];
+        for (const string_ref *ref : { &r.version_name, &r.api_url, &r.url, &r.changelog, &r.linux_download_url, &r.windows_download_url, &r.linux_download_digest, &r.windows_download_digest })
+        {
+            if (!ref_ok(*ref)) return false;
+        }
+    }
+
+    const etag_record *etags = (const etag_record*) (releases + hdr->release_count);
+    for (uint32_t i = 0; i < hdr->etag_count; i++)
+    {
+        if (!ref_ok(etags[i].url) || !ref_ok(etags[i].etag)) return false;
+    }
+
+    _header = hdr;
+    _releases = releases;
+    _etags = etags;
+    _strings = strings;
+    return true;
+}
+
+size_t catalog::snapshot::release_count() const
+{
+    return _header ? _header->release_count : 0;
+}
+
+catalog::snapshot::release_view catalog::snapshot::release(size_t index) const
+{
+    const release_record &r = _releases[index];
+
+    release_view view;
+    view.version_name = get_string(r.version_name);
+    view.api_url = get_string(r.api_url);
+    view.url = get_string(r.url);
+    view.changelog = get_string(r.changelog);
+    view.linux_download_url = get_string(r.linux_download_url);
+    view.windows_download_url = get_string(r.windows_download_url);
+    view.linux_download_digest = get_string(r.linux_download_digest);
+    view.windows_download_digest = get_string(r.windows_download_digest);
+    view.linux_download_size = r.linux_download_size;
+    view.windows_download_size = r.windows_download_size;
+    return view;
+}
+
+int catalog::snapshot::find_release(const std::string &version) const
+{
+    for (size_t i = 0; i < release_count(); i++)
+    {
+        if (is_release_of(get_string(_releases[i].version_name), version))
+            return (int) i;
+    }
+
+    return -1;
+}
+
+void catalog::snapshot::read(release_catalog &out_catalog) const
+{
+    out_catalog = {};
+    if (!_header) return;
+
+    out_catalog.releases.reserve(_header->release_count);
+    for (size_t i = 0; i < _header->release_count; i++)
+        out_catalog.releases.push_back(release(i).to_release_info());
+
+    for (size_t i = 0; i < _header->etag_count; i++)
+    {
+        const etag_record &e = _etags[i];
+        auto &etags = e.kind == ETAG_NIGHTLY ? out_catalog.nightly_etags : out_catalog.list_etags;
+        etags[std::string(get_string(e.url))] = get_string(e.etag);
+    }
+}
+
+std::vector<uint8_t> catalog::snapshot::serialize(const release_catalog &catalog)
+{
+    std::string strings;
+    auto add_string = [&](const std::string &str)
+    {
+        if (strings.size() + str.size() + 1 > UINT32_MAX)
+            throw std::runtime_error("ERROR: Release catalog is too large");
+
+        string_ref ref { (uint32_t) strings.size(), (uint32_t) str.size() };
+        strings += str;
+        strings += '\0';
+        return ref;
+    };
+
+    std::vector<release_record> releases;
+    for (auto &release : catalog.releases)
+    {
+        release_record r {};
+        r.version_name = add_string(release.version_name);
+        r.api_url = add_string(release.api_url);
+        r.url = add_string(release.url);
+        r.changelog = add_string(release.changelog);
+        r.linux_download_url = add_string(release.linux_download_url);
+        r.windows_download_url = add_string(release.windows_download_url);
+        r.linux_download_digest = add_string(release.linux_download_digest);
+        r.windows_download_digest = add_string(release.windows_download_digest);
+        r.linux_download_size = release.linux_download_size;
+        r.windows_download_size = release.windows_download_size;
+        releases.push_back(r);
+    }
+
+    std::vector<etag_record> etags;
+    for (auto &[url, etag] : catalog.nightly_etags)
+        etags.push_back({ ETAG_NIGHTLY, 0, add_string(url), add_string(etag) });
+    for (auto &[url, etag] : catalog.list_etags)
+        etags.push_back({ ETAG_LIST, 0, add_string(url), add_string(etag) });
+
+    header hdr {};
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    hdr.byte_order = SNAPSHOT_BYTE_ORDER;
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.release_count = (uint32_t) releases.size();
+    hdr.etag_count = (uint32_t) etags.size();
+    hdr.strings_offset = sizeof(header) + releases.size() * sizeof(release_record) + etags.size() * sizeof(etag_record);
+    hdr.strings_size = strings.size();
+
+    std::vector<uint8_t> data;
+    data.reserve(hdr.strings_offset + strings.size());
+    auto append = [&](const void *bytes, size_t size)
+    {
+        data.insert(data.end(), (const uint8_t*) bytes, (const uint8_t*) bytes + size);
+    };
+
+    append(&hdr, sizeof(hdr));
+    append(releases.data(), releases.size() * sizeof(release_record));
+    append(etags.data(), etags.size() * sizeof(etag_record));
+    append(strings.data(), strings.size());
+    return data;
+}
+
+static void write_file(const std::filesystem::path &path, const uint8_t *data, size_t size)
+{
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    if (!stream.is_open())
+        throw std::runtime_error("ERROR: Could not write " + path.u8string());
+
+    stream.write((const char*) data, size);
+
+    if (!stream)
+        throw std::runtime_error("ERROR: Could not write " + path.u8string());
+}
+
+void catalog::snapshot::save(const std::filesystem::path &path) const
+{
+    if (!_header)
+        throw std::runtime_error("ERROR: Release catalog snapshot is not open");
+
+    const uint8_t *data = (const uint8_t*) _header;
+    size_t size = _header->strings_offset + _header->strings_size;
+    write_file(path, data, size);
+}
+
+void catalog::snapshot::write(const std::filesystem::path &path, const release_catalog &catalog)
+{
+    std::vector<uint8_t> data = serialize(catalog);
+    write_file(path, data.data(), data.size());
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "catalog.hpp"
+#include "sys.hpp"
+
+namespace catalog
+{
+    /**
+    * A read-only, memory-mapped view of a release catalog saved in a compact
+    * binary format: a header, a fixed-size record for each release and ETag,
+    * and a table that all strings point into. Nothing is parsed when a snapshot
+    * is opened; the records are read straight out of the mapping. Every string
+    * is followed by a null byte, so the data of a view can be passed on as a
+    * C string.
+    *
+    * The ui keeps the snapshot it was started with mapped for as long as it
+    * shows the catalog. A refreshed catalog is built into a snapshot in memory,
+    * which is read the same way.
+    *
+    * A snapshot written by a different format version, or on a machine with a
+    * different byte order, fails to open, so the catalog gets rebuilt.
+    **/
+    class snapshot
+    {
+    public:
+        struct release_view
+        {
+            std::string_view version_name;
+            std::string_view api_url;
+            std::string_view url;
+            std::string_view changelog;
+            std::string_view linux_download_url;
+            std::string_view windows_download_url;
+            std::string_view linux_download_digest;
+            std::string_view windows_download_digest;
+            uint64_t linux_download_size;
+            uint64_t windows_download_size;
+
+            ReleaseInfo to_release_info() const;
+        };
+
+    private:
+        struct string_ref;
+        struct header;
+        struct release_record;
+        struct etag_record;
+
+        sys::mapped_file _file;
+
+        // the bytes of a snapshot built in memory instead of mapped
+        std::vector<uint8_t> _buffer;
+
+        const header *_header = nullptr;
+        const release_record *_releases = nullptr;
+        const etag_record *_etags = nullptr;
+        const char *_strings = nullptr;
+
+        std::string_view get_string(const string_ref &ref) const;
+        bool attach(const uint8_t *data, size_t size);
+        static std::vector<uint8_t> serialize(const release_catalog &catalog);
+
+    public:
+        snapshot() = default;
+        snapshot(const snapshot&) = delete;
+        snapshot& operator=(const snapshot&) = delete;
+
+        /**
+        * Map a snapshot file. Returns false if it doesn't exist, is damaged, or
+        * was written by another version of the format.
+        **/
+        bool open(const std::filesystem::path &path);
+
+        /**
+        * Build a snapshot of a catalog in memory.
+        **/
+        static std::unique_ptr<snapshot> create(const release_catalog &catalog);
+
+        size_t release_count() const;
+        release_view release(size_t index) const;
+
+        /**
+        * Find the release matching an installed Rained version, like
+        * catalog::find_release. Returns -1 if there is none.
+        **/
+        int find_release(const std::string &version) const;
+
+        /**
+        * Copy the whole snapshot into a release_catalog.
+        **/
+        void read(release_catalog &out_catalog) const;
+
+        /**
+        * Write the snapshot to a file.
+        **/
+        void save(const std::filesystem::path &path) const;
+
+        /**
+        * Write a catalog to a snapshot file.
+        **/
+        static void write(const std::filesystem::path &path, const release_catalog &catalog);
+    };
+}
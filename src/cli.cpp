@@ -0,0 +1,619 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include "cli.hpp"
+#include "app.hpp"
+#include "cache.hpp"
+#include "catalog.hpp"
+#include "download.hpp"
+#include "installed.hpp"
+#include "side_by_side.hpp"
+#include "util.hpp"
+#include "verify.hpp"
+#include "json.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace nlohmann;
+
+// exit codes
+constexpr int EXIT_OK = 0;
+constexpr int EXIT_ERROR = 1;
+constexpr int EXIT_NOT_CLEAN = 2; // damaged files remain, or an install was aborted by --on-change
+constexpr int EXIT_USAGE = 64;
+
+static const char *USAGE =
+    "usage: rainedvm <command> [options]\n"
+    "\n"
+    "commands:\n"
+    "  list                  list the available versions\n"
+    "  install <version>     install a version, e.g. v3.0.0 or Nightly\n"
+    "  sync                  install the newest version if it isn't installed\n"
+    "  verify                check the installed files against the installed\n"
+    "                        version, and report missing, corrupted and modified\n"
+    "                        files\n"
+    "  rollback              restore the installation that the last install\n"
+    "                        replaced, without downloading anything\n"
+    "  cache                 show how much the release cache holds, and how\n"
+    "                        often it saved a download\n"
+    "\n"
+    "options:\n"
+    "  --dir <path>          the Rained directory. defaults to $RAINED_DIRECTORY,\n"
+    "                        or the current directory.\n"
+    "  --refresh             (list) fetch the release list even if it is cached\n"
+    "  --nightly             (sync) follow the nightly release instead of the\n"
+    "                        newest stable one\n"
+    "  --repair              (verify) extract the damaged files again\n"
+    "  --prune               (cache) delete the least recently used archives\n"
+    "                        until the cache fits in cache_max_bytes\n"
+    "  --on-change <policy>  (install, sync, verify, rollback) what to do with installed files\n"
+    "                        that were changed locally: keep (default), overwrite,\n"
+    "                        or abort\n"
+    "\n"
+    "output is one JSON object per line.\n";
+
+namespace
+{
+    enum class overwrite_policy
+    {
+        keep,
+        overwrite,
+        abort
+    };
+
+    struct options
+    {
+        std::string command;
+        std::vector<std::string> operands;
+        std::filesystem::path dir;
+        overwrite_policy on_change = overwrite_policy::keep;
+        bool refresh = false;
+        bool nightly = false;
+        bool repair = false;
+        bool prune = false;
+    };
+
+    class usage_error : public std::runtime_error
+    {
+    public:
+        usage_error(const std::string &msg) : std::runtime_error(msg)
+        {}
+    };
+}
+
+// where events are written. the rest of rainedvm logs to stdout, so in
+// command-line mode stdout is pointed at stderr, and this is the original.
+static FILE *output = stdout;
+
+static FILE* take_stdout()
+{
+    fflush(stdout);
+
+#ifdef _WIN32
+    int fd = _dup(_fileno(stdout));
+    if (fd < 0) return stdout;
+    _dup2(_fileno(stderr), _fileno(stdout));
+    FILE *file = _fdopen(fd, "w");
+#else
+    int fd = dup(STDOUT_FILENO);
+    if (fd < 0) return stdout;
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    FILE *file = fdopen(fd, "w");
+#endif
+
+    return file ? file : stdout;
+}
+
+static void emit(const json &event)
+{
+    // a file name that isn't valid utf-8 shouldn't make the command fail
+    std::string line = event.dump(-1, ' ', false, json::error_handler_t::replace);
+    fputs(line.c_str(), output);
+    fputc('\n', output);
+    fflush(output);
+}
+
+static const char* policy_name(overwrite_policy policy)
+{
+    switch (policy)
+    {
+        case overwrite_policy::keep: return "keep";
+        case overwrite_policy::overwrite: return "overwrite";
+        case overwrite_policy::abort: return "abort";
+    }
+
+    return "";
+}
+
+static options parse_options(const std::vector<std::string> &args)
+{
+    options opts;
+    opts.command = args[1];
+
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        const std::string &arg = args[i];
+
+        // options that take a value
+        if (arg == "--dir" || arg == "--on-change")
+        {
+            if (i + 1 >= args.size())
+                throw usage_error(arg + " needs a value");
+
+            const std::string &value = args[++i];
+            if (arg == "--dir")
+            {
+                opts.dir = std::filesystem::u8path(value);
+            }
+            else if (value == "keep") opts.on_change = overwrite_policy::keep;
+            else if (value == "overwrite") opts.on_change = overwrite_policy::overwrite;
+            else if (value == "abort") opts.on_change = overwrite_policy::abort;
+            else throw usage_error("unknown --on-change policy " + value);
+        }
+        else if (arg == "--refresh")
+        {
+            opts.refresh = true;
+        }
+        else if (arg == "--nightly")
+        {
+            opts.nightly = true;
+        }
+        else if (arg == "--repair")
+        {
+            opts.repair = true;
+        }
+        else if (arg == "--prune")
+        {
+            opts.prune = true;
+        }
+        else if (arg.size() > 2 && arg.substr(0, 2) == "--")
+        {
+            throw usage_error("unknown option " + arg);
+        }
+        else
+        {
+            opts.operands.push_back(arg);
+        }
+    }
+
+    return opts;
+}
+
+// the directory to install into. .rainedvm is relative to the working
+// directory, so --dir changes into it, as if rainedvm was started from there.
+static std::filesystem::path rained_directory(const options &opts)
+{
+    if (!opts.dir.empty())
+    {
+        std::filesystem::create_directories(opts.dir);
+        std::filesystem::current_path(opts.dir);
+        return std::filesystem::current_path();
+    }
+
+    const char *rained_env = std::getenv("RAINED_DIRECTORY");
+    if (rained_env != nullptr)
+        return std::filesystem::u8path(rained_env);
+
+    return std::filesystem::current_path();
+}
+
+// get the release list, from the cache unless a refresh is wanted or it
+// has to be. a failed refresh falls back to the cache.
+static void load_catalog(catalog::release_catalog &out_catalog, bool refresh)
+{
+    bool is_cached = catalog::load_cache(out_catalog);
+    if (is_cached && !refresh)
+        return;
+
+    bool changed;
+    if (!catalog::fetch(out_catalog, changed))
+    {
+        if (!is_cached)
+            throw std::runtime_error("could not fetch release list");
+
+        emit({ { "event", "warning" }, { "message", "could not refresh release list, using the cached one" } });
+        return;
+    }
+
+    if (changed || !is_cached)
+        catalog::save_cache(out_catalog);
+}
+
+// the installed version, and its entry in the catalog. the version is empty
+// if rained isn't installed.
+static ReleaseInfo installed_release(const std::filesystem::path &rained_dir, catalog::release_catalog &catalog, bool is_refreshed, std::string &out_version)
+{
+    out_version.clear();
+    std::filesystem::path install_dir = side_by_side::active_dir(rained_dir);
+    if (!std::filesystem::is_regular_file(install_dir / "Rained") && !std::filesystem::is_regular_file(install_dir / "Rained.exe"))
+        return {};
+
+    if (!installed::get_version(install_dir, out_version))
+        throw std::runtime_error("could not get current rained version");
+
+    int index = catalog::find_release(catalog.releases, out_version);
+
+    // a cached list may predate the installed version
+    if (index < 0 && !is_refreshed)
+    {
+        load_catalog(catalog, true);
+        index = catalog::find_release(catalog.releases, out_version);
+    }
+
+    if (index < 0)
+        throw std::runtime_error("could not find release info for the installed version " + out_version);
+
+    return catalog.releases[index];
+}
+
+// the install task wakes the main loop when it has news, which here is the
+// loop in run_install
+static std::mutex wake_mutex;
+static std::condition_variable wake_cv;
+static bool is_woken = false;
+
+static void wake()
+{
+    {
+        std::lock_guard lock(wake_mutex);
+        is_woken = true;
+    }
+    wake_cv.notify_all();
+}
+
+static void wait_for_wake()
+{
+    // progress is published without waking, so check it a few times a second
+    std::unique_lock lock(wake_mutex);
+    wake_cv.wait_for(lock, std::chrono::milliseconds(100), []{ return is_woken; });
+    is_woken = false;
+}
+
+// report the progress of an install task until it is done, answering its
+// prompts by the policy. returns false if it failed.
+static bool run_task(InstallTask &task, overwrite_policy on_change, bool &out_aborted)
+{
+    std::string status;
+    int last_percent = -1;
+    int last_retries = 0;
+    out_aborted = false;
+
+    while (true)
+    {
+        wait_for_wake();
+        task.poll_events();
+
+        float progress;
+        bool is_running = task.get_progress(progress);
+
+        if (task.status() != status)
+        {
+            status = task.status();
+            last_percent = -1;
+            emit({ { "event", "status" }, { "text", status } });
+        }
+
+        int retries, stalls;
+        bool waiting;
+        if (task.get_download_stats(retries, stalls, waiting) && retries != last_retries)
+        {
+            last_retries = retries;
+            emit({ { "event", "retry" }, { "retries", retries }, { "stalls", stalls } });
+        }
+
+        if (is_running && progress >= 0.0f && (int)(progress * 100.0f) != last_percent)
+        {
+            last_percent = (int)(progress * 100.0f);
+            emit({ { "event", "progress" }, { "percent", last_percent } });
+        }
+
+        if (const std::string *prompt_path = task.get_overwrite_prompt())
+        {
+            emit({ { "event", "local_change" }, { "path", *prompt_path }, { "action", policy_name(on_change) } });
+
+            switch (on_change)
+            {
+                case overwrite_policy::keep: task.set_overwrite_prompt_result(0); break;
+                case overwrite_policy::overwrite: task.set_overwrite_prompt_result(1); break;
+                case overwrite_policy::abort:
+                    task.set_overwrite_prompt_result(2);
+                    out_aborted = true;
+                    break;
+            }
+        }
+
+        if (!is_running)
+            break;
+    }
+
+    if (task.is_faulted())
+    {
+        emit({ { "event", "error" }, { "message", task.exception() } });
+        return false;
+    }
+
+    return true;
+}
+
+static int run_install(const std::filesystem::path &rained_dir, const ReleaseInfo &cur_release, const ReleaseInfo &release, overwrite_policy on_change)
+{
+    emit({ { "event", "install" }, { "version", release.version_name }, { "from", cur_release.version_name } });
+
+    util::set_wake_handler(wake);
+    InstallTask task(rained_dir, cur_release, release);
+
+    bool is_aborted;
+    bool is_ok = run_task(task, on_change, is_aborted);
+    util::set_wake_handler(nullptr);
+
+    if (!is_ok)
+        return EXIT_ERROR;
+
+    if (is_aborted)
+    {
+        emit({ { "event", "aborted" }, { "version", release.version_name } });
+        return EXIT_NOT_CLEAN;
+    }
+
+    emit({ { "event", "installed" }, { "version", release.version_name } });
+    return EXIT_OK;
+}
+
+static int cmd_list(const options &opts)
+{
+    std::filesystem::path rained_dir = rained_directory(opts);
+
+    catalog::release_catalog catalog;
+    load_catalog(catalog, opts.refresh);
+
+    std::string cur_version;
+    ReleaseInfo cur_release = installed_release(rained_dir, catalog, opts.refresh, cur_version);
+
+    for (auto &release : catalog.releases)
+    {
+        emit({
+            { "event", "release" },
+            { "version", release.version_name },
+            { "installed", !cur_version.empty() && release.version_name == cur_release.version_name },
+            { "url", release.url }
+        });
+    }
+
+    return EXIT_OK;
+}
+
+static int cmd_install(const options &opts)
+{
+    if (opts.operands.size() != 1)
+        throw usage_error("install needs exactly one version");
+
+    const std::string &version = opts.operands[0];
+    std::filesystem::path rained_dir = rained_directory(opts);
+
+    catalog::release_catalog catalog;
+    load_catalog(catalog, false);
+
+    auto find_version = [&]() -> int
+    {
+        for (size_t i = 0; i < catalog.releases.size(); i++)
+        {
+            if (catalog.releases[i].version_name == version)
+                return (int)i;
+        }
+        return -1;
+    };
+
+    bool is_refreshed = false;
+    int index = find_version();
+    if (index < 0)
+    {
+        load_catalog(catalog, true);
+        is_refreshed = true;
+        index = find_version();
+    }
+
+    if (index < 0)
+        throw std::runtime_error("no release named " + version);
+
+    ReleaseInfo release = catalog.releases[index];
+
+    std::string cur_version;
+    ReleaseInfo cur_release = installed_release(rained_dir, catalog, is_refreshed, cur_version);
+
+    // a nightly build may be outdated even if it has the same name
+    if (!cur_version.empty() && cur_release.version_name == release.version_name && release.version_name != "Nightly")
+    {
+        emit({ { "event", "up_to_date" }, { "version", release.version_name } });
+        return EXIT_OK;
+    }
+
+    return run_install(rained_dir, cur_release, release, opts.on_change);
+}
+
+static int cmd_sync(const options &opts)
+{
+    std::filesystem::path rained_dir = rained_directory(opts);
+
+    // the point of syncing is to get what is newest on the server
+    catalog::release_catalog catalog;
+    load_catalog(catalog, true);
+
+    const ReleaseInfo *latest = nullptr;
+    for (auto &release : catalog.releases)
+    {
+        if ((release.version_name == "Nightly") == opts.nightly)
+        {
+            latest = &release;
+            break;
+        }
+    }
+
+    if (latest == nullptr)
+        throw std::runtime_error(opts.nightly ? "there is no nightly release" : "there is no stable release");
+
+    std::string cur_version;
+    ReleaseInfo cur_release = installed_release(rained_dir, catalog, true, cur_version);
+
+    if (!cur_version.empty() && cur_release.version_name == latest->version_name && !opts.nightly)
+    {
+        emit({ { "event", "up_to_date" }, { "version", latest->version_name } });
+        return EXIT_OK;
+    }
+
+    return run_install(rained_dir, cur_release, *latest, opts.on_change);
+}
+
+static int cmd_verify(const options &opts)
+{
+    std::filesystem::path rained_dir = side_by_side::active_dir(rained_directory(opts));
+
+    if (!std::filesystem::is_regular_file(rained_dir / "Rained") && !std::filesystem::is_regular_file(rained_dir / "Rained.exe"))
+        throw std::runtime_error("Rained is not installed in " + rained_dir.u8string());
+
+    // the archive of the installed version is kept for uninstalling it
+    std::filesystem::path archive_path = download::rainedvm_path() / ("rained-current" ARCHIVE_EXT);
+    if (!std::filesystem::is_regular_file(archive_path))
+        throw std::runtime_error("there is no archive of the installed version to verify against");
+
+    verify::report report = verify::check(rained_dir, archive_path);
+
+    bool has_modified = false;
+    for (auto &file : report.damaged)
+    {
+        has_modified = has_modified || file.state == verify::file_state::modified;
+        emit({ { "event", verify::state_name(file.state) }, { "path", file.path.u8string() } });
+    }
+
+    emit({ { "event", "verified" }, { "files", report.files_checked }, { "damaged", report.damaged.size() } });
+
+    if (!opts.repair || report.damaged.empty())
+        return report.damaged.empty() ? EXIT_OK : EXIT_NOT_CLEAN;
+
+    if (has_modified && opts.on_change == overwrite_policy::abort)
+    {
+        emit({ { "event", "aborted" } });
+        return EXIT_NOT_CLEAN;
+    }
+
+    // files changed by the user are only replaced if asked to
+    std::vector<std::filesystem::path> to_repair;
+    for (auto &file : report.damaged)
+    {
+        if (file.state != verify::file_state::modified || opts.on_change == overwrite_policy::overwrite)
+            to_repair.push_back(file.path);
+    }
+
+    verify::repair(rained_dir, archive_path, to_repair);
+    for (auto &path : to_repair)
+        emit({ { "event", "repaired" }, { "path", path.u8string() } });
+
+    return to_repair.size() == report.damaged.size() ? EXIT_OK : EXIT_NOT_CLEAN;
+}
+
+static int cmd_rollback(const options &opts)
+{
+    std::filesystem::path rained_dir = rained_directory(opts);
+
+    emit({ { "event", "rollback" } });
+
+    util::set_wake_handler(wake);
+    auto task = InstallTask::rollback(rained_dir);
+
+    bool is_aborted;
+    bool is_ok = run_task(*task, opts.on_change, is_aborted);
+    util::set_wake_handler(nullptr);
+
+    if (!is_ok)
+        return EXIT_ERROR;
+
+    if (is_aborted)
+    {
+        emit({ { "event", "aborted" } });
+        return EXIT_NOT_CLEAN;
+    }
+
+    emit({
+        { "event", "rolled_back" },
+        { "version", task->installed_version() },
+        { "milliseconds", task->elapsed().count() }
+    });
+
+    return EXIT_OK;
+}
+
+static int cmd_cache(const options &opts)
+{
+    rained_directory(opts);
+
+    if (opts.prune)
+        emit({ { "event", "pruned" }, { "bytes_freed", cache::enforce_budget() } });
+
+    cache::stats stats = cache::get_stats();
+    emit({
+        { "event", "cache" },
+        { "archives", stats.archive_count },
+        { "size", stats.total_size },
+        { "budget", stats.budget },
+        { "hits", stats.hits },
+        { "misses", stats.misses },
+        { "hit_rate", stats.hit_rate() },
+        { "bytes_saved", stats.bytes_saved }
+    });
+
+    return EXIT_OK;
+}
+
+bool cli::is_command(const std::vector<std::string> &args)
+{
+    if (args.size() < 2)
+        return false;
+
+    const std::string &cmd = args[1];
+    return cmd == "list" || cmd == "install" || cmd == "sync" || cmd == "verify" || cmd == "rollback" || cmd == "cache" || cmd == "help" || cmd == "--help";
+}
+
+int cli::run(const std::vector<std::string> &args)
+{
+#ifdef _WIN32
+    // rainedvm is a gui program, so it has to ask for the console it was started from
+    if (AttachConsole(ATTACH_PARENT_PROCESS))
+    {
+        freopen("CONOUT$", "w", stdout);
+        freopen("CONOUT$", "w", stderr);
+    }
+#endif
+
+    output = take_stdout();
+
+    try
+    {
+        options opts = parse_options(args);
+
+        if (opts.command == "list") return cmd_list(opts);
+        if (opts.command == "install") return cmd_install(opts);
+        if (opts.command == "sync") return cmd_sync(opts);
+        if (opts.command == "verify") return cmd_verify(opts);
+        if (opts.command == "rollback") return cmd_rollback(opts);
+        if (opts.command == "cache") return cmd_cache(opts);
+
+        fputs(USAGE, output);
+        return EXIT_OK;
+    }
+    catch (usage_error &e)
+    {
+        fprintf(stderr, "error: %s\n\n%s", e.what(), USAGE);
+        return EXIT_USAGE;
+    }
+    catch (std::exception &e)
+    {
+        emit({ { "event", "error" }, { "message", e.what() } });
+        return EXIT_ERROR;
+    }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+* Command-line mode, for scripts and machines without a display. Commands run
+* without creating a window or initializing GLFW, and report what they do on
+* stdout as one JSON object per line.
+**/
+namespace cli
+{
+    /**
+    * Returns true if the arguments start with a command, in which case the
+    * GUI shouldn't be started.
+    **/
+    bool is_command(const std::vector<std::string> &args);
+
+    /**
+    * Run the command given in the arguments, and return the exit code.
+    **/
+    int run(const std::vector<std::string> &args);
+}
@@ -0,0 +1,78 @@
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include "config.hpp"
+#include "download.hpp"
+#include "json.hpp"
+
+using namespace nlohmann;
+
+static std::filesystem::path config_path()
+{
+    return download::rainedvm_path() / "config.json";
+}
+
+// guards the settings, which the UI changes while workers read them
+static std::mutex settings_mutex;
+
+static config::settings load_settings()
+{
+    config::settings cfg;
+
+    std::ifstream stream(config_path());
+    if (stream.is_open())
+    {
+        try
+        {
+            json data = json::parse(stream);
+            cfg.prefetch_releases = data.value("prefetch_releases", cfg.prefetch_releases);
+            cfg.download_min_speed = data.value("download_min_speed", cfg.download_min_speed);
+            cfg.download_stall_time = data.value("download_stall_time", cfg.download_stall_time);
+            cfg.download_max_retries = data.value("download_max_retries", cfg.download_max_retries);
+            cfg.max_releases = data.value("max_releases", cfg.max_releases);
+            cfg.cache_max_bytes = data.value("cache_max_bytes", cfg.cache_max_bytes);
+            cfg.shared_cache = data.value("shared_cache", cfg.shared_cache);
+            cfg.side_by_side_installs = data.value("side_by_side_installs", cfg.side_by_side_installs);
+            cfg.mirrors = data.value("mirrors", cfg.mirrors);
+        }
+        catch (json::exception &e)
+        {
+            fprintf(stderr, "could not parse config.json: %s\n", e.what());
+        }
+    }
+
+    return cfg;
+}
+
+// only called with settings_mutex held
+static config::settings& current_settings()
+{
+    static config::settings cfg = load_settings();
+    return cfg;
+}
+
+config::settings config::get()
+{
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    return current_settings();
+}
+
+void config::set(const settings &cfg)
+{
+    std::lock_guard<std::mutex> lock(settings_mutex);
+    current_settings() = cfg;
+
+    json data;
+    data["prefetch_releases"] = cfg.prefetch_releases;
+    data["download_min_speed"] = cfg.download_min_speed;
+    data["download_stall_time"] = cfg.download_stall_time;
+    data["download_max_retries"] = cfg.download_max_retries;
+    data["max_releases"] = cfg.max_releases;
+    data["cache_max_bytes"] = cfg.cache_max_bytes;
+    data["shared_cache"] = cfg.shared_cache;
+    data["side_by_side_installs"] = cfg.side_by_side_installs;
+    data["mirrors"] = cfg.mirrors;
+
+    std::ofstream stream(config_path());
+    stream << data.dump(4);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+* User settings, stored in .rainedvm/config.json
+**/
+namespace config
+{
+    struct settings
+    {
+        // download the selected release into the cache in the background,
+        // before Install is pressed
+        bool prefetch_releases = false;
+
+        // a download that stays below download_min_speed bytes/sec for
+        // download_stall_time seconds is considered stalled, and is retried
+        // up to download_max_retries times
+        int download_min_speed = 1024;
+        int download_stall_time = 15;
+        int download_max_retries = 5;
+
+        // maximum number of versioned releases listed. GitHub serves the
+        // release list in pages, which are fetched until this many are known
+        int max_releases = 300;
+
+        // the release archives in the cache are kept below this many bytes by
+        // deleting the least recently used ones. 0 for no limit. see cache.hpp
+        uint64_t cache_max_bytes = 2ULL << 30;
+
+        // keep release archives in a cache directory shared by every
+        // installation of this user, instead of in .rainedvm. see download.hpp
+        bool shared_cache = false;
+
+        // keep every installed version in its own directory, and switch
+        // between them with a link. see side_by_side.hpp
+        bool side_by_side_installs = false;
+
+        // base URLs of release mirrors, see mirror.hpp
+        std::vector<std::string> mirrors;
+    };
+
+    /**
+    * Get a copy of the current settings, loading them from disk on first use.
+    * Safe to call from any thread.
+    **/
+    settings get();
+
+    /**
+    * Replace the current settings and write them to disk.
+    **/
+    void set(const settings &cfg);
+}
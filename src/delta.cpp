@@ -0,0 +1,266 @@
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include "delta.hpp"
+
+static const char BLOCK_MAP_MAGIC[8] = { 'R', 'V', 'M', 'B', 'M', 'A', 'P', '1' };
+
+// bytes per block in a block map: the weak and the strong checksum
+static const uint64_t BLOCK_RECORD_SIZE = 4 + 8;
+
+uint32_t delta::block_map::size_of_block(size_t index) const
+{
+    uint64_t start = (uint64_t)index * block_size;
+    return (uint32_t)std::min<uint64_t>(block_size, file_size - start);
+}
+
+uint64_t delta::hash64(const char *data, size_t size, uint64_t hash)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool delta::hash_file(const std::filesystem::path &path, uint64_t &out_hash)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+        return false;
+
+    char buf[65536];
+    uint64_t hash = hash64(nullptr, 0);
+    while (stream)
+    {
+        stream.read(buf, sizeof(buf));
+        hash = hash64(buf, (size_t)stream.gcount(), hash);
+    }
+
+    if (stream.bad())
+        return false;
+
+    out_hash = hash;
+    return true;
+}
+
+namespace
+{
+    // the rsync rolling checksum. a is the sum of the bytes in the window, and b
+    // is the sum of a over each prefix of the window, both mod 2^16.
+    struct rolling_checksum
+    {
+        uint32_t a = 0;
+        uint32_t b = 0;
+        size_t len = 0;
+
+        void reset(const char *data, size_t size)
+        {
+            a = 0;
+            b = 0;
+            len = size;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                a += (unsigned char)data[i];
+                b += (uint32_t)(size - i) * (unsigned char)data[i];
+            }
+        }
+
+        void roll(unsigned char out, unsigned char in)
+        {
+            a += in - out;
+            b += a - (uint32_t)len * out;
+        }
+
+        uint32_t digest() const
+        {
+            return (a & 0xFFFF) | (b << 16);
+        }
+    };
+}
+
+uint32_t delta::weak_checksum(const char *data, size_t size)
+{
+    rolling_checksum sum;
+    sum.reset(data, size);
+    return sum.digest();
+}
+
+static std::vector<char> read_whole_file(const std::filesystem::path &file_path)
+{
+    std::ifstream stream(file_path, std::ios::binary);
+    if (!stream.is_open())
+        throw delta::delta_exception("could not open " + file_path.u8string());
+
+    std::vector<char> data(std::filesystem::file_size(file_path));
+    stream.read(data.data(), data.size());
+    if ((size_t)stream.gcount() != data.size())
+        throw delta::delta_exception("could not read " + file_path.u8string());
+
+    return data;
+}
+
+delta::block_map delta::generate_block_map(const std::filesystem::path &file_path, uint32_t block_size)
+{
+    std::vector<char> data = read_whole_file(file_path);
+
+    block_map map;
+    map.file_size = data.size();
+    map.file_hash = hash64(data.data(), data.size());
+    map.block_size = block_size;
+
+    for (uint64_t pos = 0; pos < data.size(); pos += block_size)
+    {
+        size_t size = (size_t)std::min<uint64_t>(block_size, data.size() - pos);
+        map.blocks.push_back({
+            weak_checksum(data.data() + pos, size),
+            hash64(data.data() + pos, size)
+        });
+    }
+
+    return map;
+}
+
+// block maps are stored little-endian regardless of the host
+static void write_le(std::ostream &stream, uint64_t v, int size)
+{
+    char buf[8];
+    for (int i = 0; i < size; i++)
+        buf[i] = (char)((v >> (i * 8)) & 0xFF);
+    stream.write(buf, size);
+}
+
+static uint64_t read_le(std::istream &stream, int size)
+{
+    unsigned char buf[8];
+    if (!stream.read((char *)buf, size))
+        throw delta::delta_exception("block map is truncated");
+
+    uint64_t v = 0;
+    for (int i = 0; i < size; i++)
+        v |= (uint64_t)buf[i] << (i * 8);
+    return v;
+}
+
+void delta::write_block_map(const block_map &map, std::ostream &stream)
+{
+    stream.write(BLOCK_MAP_MAGIC, sizeof(BLOCK_MAP_MAGIC));
+    write_le(stream, map.block_size, 4);
+    write_le(stream, map.file_size, 8);
+    write_le(stream, map.file_hash, 8);
+
+    for (auto &block : map.blocks)
+    {
+        write_le(stream, block.weak, 4);
+        write_le(stream, block.strong, 8);
+    }
+}
+
+delta::block_map delta::read_block_map(std::istream &stream)
+{
+    char magic[sizeof(BLOCK_MAP_MAGIC)];
+    if (!stream.read(magic, sizeof(magic)) || memcmp(magic, BLOCK_MAP_MAGIC, sizeof(magic)) != 0)
+        throw delta_exception("not a block map");
+
+    block_map map;
+    map.block_size = (uint32_t)read_le(stream, 4);
+    map.file_size = read_le(stream, 8);
+    map.file_hash = read_le(stream, 8);
+
+    if (map.block_size == 0)
+        throw delta_exception("block map has an invalid block size");
+
+    uint64_t block_count = map.file_size / map.block_size + (map.file_size % map.block_size != 0 ? 1 : 0);
+
+    // block maps are downloaded, so the header can claim any number of blocks.
+    // check it against what is left of the stream before allocating them.
+    std::istream::pos_type pos = stream.tellg();
+    if (pos != std::istream::pos_type(-1))
+    {
+        stream.seekg(0, std::ios::end);
+        std::istream::pos_type end = stream.tellg();
+        stream.seekg(pos);
+
+        if (end != std::istream::pos_type(-1) && block_count > (uint64_t)(end - pos) / BLOCK_RECORD_SIZE)
+            throw delta_exception("block map is truncated");
+
+        map.blocks.reserve(block_count);
+    }
+
+    // a stream that can't seek ends with an error once its data runs out
+    for (uint64_t i = 0; i < block_count; i++)
+    {
+        block_checksum block;
+        block.weak = (uint32_t)read_le(stream, 4);
+        block.strong = read_le(stream, 8);
+        map.blocks.push_back(block);
+    }
+
+    return map;
+}
+
+std::vector<delta::block_source> delta::match_blocks(const block_map &map, const std::vector<std::filesystem::path> &seeds)
+{
+    std::vector<block_source> result(map.blocks.size(), { -1, 0 });
+    const size_t block_size = map.block_size;
+
+    // the short block at the end of the file is not worth matching
+    size_t full_blocks = map.file_size / block_size;
+    std::unordered_multimap<uint32_t, size_t> weak_index;
+    for (size_t i = 0; i < full_blocks; i++)
+        weak_index.emplace(map.blocks[i].weak, i);
+
+    size_t unmatched = full_blocks;
+
+    for (size_t seed_index = 0; seed_index < seeds.size() && unmatched > 0; seed_index++)
+    {
+        std::vector<char> data = read_whole_file(seeds[seed_index]);
+        if (data.size() < block_size) continue;
+
+        rolling_checksum sum;
+        sum.reset(data.data(), block_size);
+        size_t pos = 0;
+
+        while (true)
+        {
+            bool matched = false;
+            auto range = weak_index.equal_range(sum.digest());
+            if (range.first != range.second)
+            {
+                uint64_t strong = hash64(data.data() + pos, block_size);
+                for (auto it = range.first; it != range.second; it++)
+                {
+                    if (map.blocks[it->second].strong != strong) continue;
+                    matched = true;
+
+                    block_source &src = result[it->second];
+                    if (src.seed < 0)
+                    {
+                        src.seed = (int)seed_index;
+                        src.offset = pos;
+                        unmatched--;
+                    }
+                }
+            }
+
+            // after a match, continue at the next block boundary like rsync does
+            if (matched && pos + 2 * block_size <= data.size())
+            {
+                pos += block_size;
+                sum.reset(data.data() + pos, block_size);
+                continue;
+            }
+
+            if (pos + block_size >= data.size())
+                break;
+
+            sum.roll(data[pos], data[pos + block_size]);
+            pos++;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+
+/**
+* zsync-style block matching. A block map lists a rolling checksum and a strong
+* hash for every fixed-size block of a file. Given the block map of a new file,
+* blocks that also appear somewhere in old files (seeds) can be copied locally,
+* so only the remaining byte ranges need to be downloaded.
+**/
+namespace delta
+{
+    constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096;
+
+    class delta_exception : public std::runtime_error
+    {
+    public:
+        delta_exception(const std::string &msg) : std::runtime_error(msg)
+        {}
+    }; // class delta_exception
+
+    struct block_checksum
+    {
+        uint32_t weak;
+        uint64_t strong;
+    };
+
+    struct block_map
+    {
+        uint64_t file_size;
+        uint64_t file_hash;
+        uint32_t block_size;
+        std::vector<block_checksum> blocks;
+
+        // size of the block at the given index, which is smaller for the last block
+        uint32_t size_of_block(size_t index) const;
+    };
+
+    /**
+    * Where the data for a block can be found locally. seed is an index into the
+    * seed list passed to match_blocks, or -1 if the block must be downloaded.
+    **/
+    struct block_source
+    {
+        int seed;
+        uint64_t offset;
+    };
+
+    /**
+    * 64-bit FNV-1a hash, used as the strong block hash and the whole file hash.
+    **/
+    uint64_t hash64(const char *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL);
+
+    /**
+    * hash64 of a whole file, read in chunks. Returns false if it can't be read.
+    **/
+    bool hash_file(const std::filesystem::path &path, uint64_t &out_hash);
+
+    /**
+    * Compute the rsync rolling checksum of a block.
+    **/
+    uint32_t weak_checksum(const char *data, size_t size);
+
+    block_map generate_block_map(const std::filesystem::path &file_path, uint32_t block_size = DEFAULT_BLOCK_SIZE);
+    void write_block_map(const block_map &map, std::ostream &stream);
+    block_map read_block_map(std::istream &stream);
+
+    /**
+    * Scan the seed files for blocks of the block map. The returned vector has an
+    * entry for each block in the map.
+    **/
+    std::vector<block_source> match_blocks(const block_map &map, const std::vector<std::filesystem::path> &seeds);
+}
@@ -0,0 +1,860 @@
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <atomic>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cpr/cpr.h>
+#include "download.hpp"
+#include "archive.hpp"
+#include "delta.hpp"
+#include "bounded_queue.hpp"
+#include "cache.hpp"
+#include "config.hpp"
+#include "mirror.hpp"
+#include "sys.hpp"
+
+const char *download::USER_AGENT = "RainedVersionManager/" RAINEDUPDATE_VERSION " (" SYS_TRIPLET ") libcpr/" CPR_VERSION " libcurl/" LIBCURL_VERSION;
+
+// max number of chunks waiting between two pipeline stages
+constexpr size_t PIPELINE_QUEUE_CAPACITY = 64;
+
+// missing ranges closer together than this are fetched with one request
+constexpr uint64_t DELTA_MERGE_GAP = 16384;
+
+// how often a download waiting for another instance checks on it
+constexpr std::chrono::milliseconds DOWNLOAD_LOCK_POLL_INTERVAL(250);
+
+const std::filesystem::path download::rainedvm_path()
+{
+    static const std::filesystem::path path = []()
+    {
+        std::filesystem::path path(".rainedvm");
+        if (!std::filesystem::exists(path))
+            std::filesystem::create_directory(path);
+
+        return path;
+    }();
+
+    return path;
+}
+
+static std::filesystem::path shared_cache_path()
+{
+#ifdef _WIN32
+    const char *local_app_data = std::getenv("LOCALAPPDATA");
+    if (local_app_data != nullptr && *local_app_data)
+        return std::filesystem::u8path(local_app_data) / "rainedvm" / "cache";
+#else
+    const char *xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+    if (xdg_cache_home != nullptr && *xdg_cache_home)
+        return std::filesystem::u8path(xdg_cache_home) / "rainedvm";
+
+    const char *home = std::getenv("HOME");
+    if (home != nullptr && *home)
+        return std::filesystem::u8path(home) / ".cache" / "rainedvm";
+#endif
+
+    return {};
+}
+
+const std::filesystem::path download::cache_path()
+{
+    static const std::filesystem::path path = []()
+    {
+        std::filesystem::path path;
+        if (config::get().shared_cache)
+            path = shared_cache_path();
+
+        if (path.empty())
+            return rainedvm_path();
+
+        std::error_code ec;
+        std::filesystem::create_directories(path, ec);
+        if (ec)
+        {
+            fprintf(stderr, "could not create %s, using .rainedvm: %s\n", path.u8string().c_str(), ec.message().c_str());
+            return rainedvm_path();
+        }
+
+        return path;
+    }();
+
+    return path;
+}
+
+static std::string release_download_url(const ReleaseInfo &release)
+{
+    std::string download_url;
+
+#if defined(_WIN32)
+    if (strcmp(SYS_ARCH, "x86_64") == 0)
+        download_url = release.windows_download_url;
+#elif defined(__linux__)
+    if (strcmp(SYS_ARCH, "x86_64") == 0)
+        download_url = release.linux_download_url;
+#elif defined(__APPLE__)
+    if (strcmp(SYS_ARCH, "x86_64") == 0)
+        download_url = release.macos_download_url;
+#endif
+
+    if (download_url.empty())
+        throw std::runtime_error("ERROR: no " SYS_OS  " download for " + release.version_name);
+
+    return download_url;
+}
+
+static std::filesystem::path release_archive_path(const ReleaseInfo &release)
+{
+#if defined(_WIN32) || defined(__linux__)
+    return download::cache_path() / std::filesystem::path("rained-" + release.version_name + ARCHIVE_EXT);
+#else
+    #error No version downloader for this platform
+#endif
+}
+
+// whether the nightly archive in the cache was downloaded during this session
+static std::atomic<bool> nightly_is_fresh = false;
+
+static void mark_release_fresh(const ReleaseInfo &release)
+{
+    if (release.version_name == "Nightly")
+        nightly_is_fresh = true;
+}
+
+bool download::is_release_cached(const ReleaseInfo &release)
+{
+    if (release.version_name == "Nightly" && !nightly_is_fresh)
+        return false;
+
+    return std::filesystem::exists(release_archive_path(release));
+}
+
+bool download::lock_release(const ReleaseInfo &release, sys::file_lock &lock, progress_callback_t progress_callback)
+{
+    std::filesystem::path archive_path = release_archive_path(release);
+    std::filesystem::path lock_path = archive_path;
+    lock_path += ".lock";
+
+    bool has_waited = false;
+    while (!lock.try_lock(lock_path))
+    {
+        if (!has_waited)
+            printf("waiting for another download of %s\n", archive_path.filename().u8string().c_str());
+
+        has_waited = true;
+        if (!progress_callback({ 0.0f, 0, 0, false }))
+            return false;
+
+        std::this_thread::sleep_for(DOWNLOAD_LOCK_POLL_INTERVAL);
+    }
+
+    // an archive that is there now was just downloaded by the other instance,
+    // so it is as fresh as if this one had
+    if (has_waited && std::filesystem::exists(archive_path))
+        mark_release_fresh(release);
+
+    return true;
+}
+
+std::filesystem::path download::lock_cached_release(const ReleaseInfo &release, sys::file_lock &lock, progress_callback_t progress_callback)
+{
+    if (!lock_release(release, lock, progress_callback)) return "";
+
+    // checked again under the lock, since the cache may have evicted it
+    if (!is_release_cached(release))
+    {
+        lock.unlock();
+        return "";
+    }
+
+    return release_archive_path(release);
+}
+
+namespace
+{
+    enum class transfer_result
+    {
+        done,
+        canceled,
+        write_failed
+    };
+}
+
+static bool is_retryable_error(cpr::ErrorCode code)
+{
+    switch (code)
+    {
+        case cpr::ErrorCode::INVALID_URL_FORMAT:
+        case cpr::ErrorCode::UNSUPPORTED_PROTOCOL:
+        case cpr::ErrorCode::TOO_MANY_REDIRECTS:
+        case cpr::ErrorCode::REQUEST_CANCELLED:
+            return false;
+
+        default:
+            return true;
+    }
+}
+
+static bool is_retryable_status(long status_code)
+{
+    return status_code == 408 || status_code == 429 || status_code >= 500;
+}
+
+// read a file from a file:// mirror, passing its contents to write_callback
+// starting at byte offset
+static transfer_result copy_local_file(
+    const std::filesystem::path &path,
+    uint64_t &offset,
+    const std::function<bool(std::string_view data)> &write_callback,
+    const download::progress_callback_t &progress_callback
+)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+        throw std::runtime_error("ERROR: could not open " + path.u8string());
+
+    uint64_t size = std::filesystem::file_size(path);
+    stream.seekg(offset);
+
+    std::vector<char> buf(1 << 20);
+    while (offset < size)
+    {
+        stream.read(buf.data(), buf.size());
+        std::streamsize count = stream.gcount();
+        if (count <= 0)
+            throw std::runtime_error("ERROR: could not read " + path.u8string());
+
+        if (!write_callback(std::string_view(buf.data(), (size_t)count)))
+            return transfer_result::write_failed;
+        offset += count;
+
+        if (!progress_callback({ (float)offset / size, 0, 0, false }))
+            return transfer_result::canceled;
+    }
+
+    return transfer_result::done;
+}
+
+// download a url, passing the response body to write_callback starting at byte
+// offset, which is advanced as data arrives. if the connection drops or its
+// speed stays below the configured minimum, the transfer is retried with
+// exponential backoff, asking the server for only the bytes it hasn't sent yet.
+static transfer_result resumable_download(
+    const std::string &url,
+    uint64_t &offset,
+    int max_retries,
+    const std::function<bool(std::string_view data)> &write_callback,
+    const download::progress_callback_t &progress_callback
+)
+{
+    if (mirror::is_file_url(url))
+        return copy_local_file(mirror::file_url_path(url), offset, write_callback, progress_callback);
+
+    config::settings cfg = config::get();
+    download::progress prog { 0.0f, 0, 0, false };
+
+    for (int attempt = 0; ; attempt++)
+    {
+        // if the server ignores the range request and sends the whole file,
+        // the part that was already received has to be skipped
+        long status_code = 0;
+        uint64_t skip = 0;
+        uint64_t attempt_start = offset;
+        bool canceled = false;
+        bool write_failed = false;
+
+        cpr::Session session;
+        session.SetUrl(cpr::Url(url));
+        session.SetUserAgent(cpr::UserAgent(download::USER_AGENT));
+        session.SetLowSpeed(cpr::LowSpeed(cfg.download_min_speed, cfg.download_stall_time));
+        session.SetConnectTimeout(cpr::ConnectTimeout(std::chrono::seconds(cfg.download_stall_time)));
+        if (offset > 0)
+            session.SetRange(cpr::Range{ (int64_t)offset, std::nullopt });
+
+        session.SetHeaderCallback(cpr::HeaderCallback([&](std::string_view header, intptr_t)
+        {
+            // each response along a redirect chain starts with a status line
+            if (header.substr(0, 5) == "HTTP/")
+            {
+                size_t space = header.find(' ');
+                if (space != std::string_view::npos)
+                    status_code = std::strtol(std::string(header.substr(space + 1, 3)).c_str(), nullptr, 10);
+
+                skip = (status_code == 200) ? offset : 0;
+                attempt_start = (status_code == 200) ? 0 : offset;
+            }
+
+            return true;
+        }));
+
+        session.SetWriteCallback(cpr::WriteCallback([&](std::string_view data, intptr_t)
+        {
+            // don't write error pages into the file
+            if (status_code != 200 && status_code != 206)
+                return true;
+
+            if (skip > 0)
+            {
+                size_t count = (size_t)std::min<uint64_t>(skip, data.size());
+                data.remove_prefix(count);
+                skip -= count;
+            }
+
+            if (!data.empty())
+            {
+                if (!write_callback(data))
+                {
+                    write_failed = true;
+                    return false;
+                }
+
+                offset += data.size();
+            }
+
+            return true;
+        }));
+
+        session.SetProgressCallback(cpr::ProgressCallback([&](cpr::cpr_off_t download_total, cpr::cpr_off_t download_now, cpr::cpr_off_t, cpr::cpr_off_t, intptr_t)
+        {
+            // download_total only counts the bytes of this attempt
+            if (download_total > 0)
+                prog.fraction = (float)(attempt_start + download_now) / (attempt_start + download_total);
+
+            prog.waiting = false;
+            canceled = !progress_callback(prog);
+            return !canceled;
+        }));
+
+        cpr::Response r = session.Get();
+
+        if (canceled)
+            return transfer_result::canceled;
+
+        if (write_failed)
+            return transfer_result::write_failed;
+
+        if (r.error.code == cpr::ErrorCode::OK && (r.status_code == 200 || r.status_code == 206))
+            return transfer_result::done;
+
+        // 416 means the range starts at the end of the file, i.e. it was already complete
+        if (r.status_code == 416 && offset > 0)
+            return transfer_result::done;
+
+        bool retryable = (r.error.code != cpr::ErrorCode::OK) ? is_retryable_error(r.error.code) : is_retryable_status(r.status_code);
+        if (!retryable || attempt >= max_retries)
+        {
+            if (r.error.code != cpr::ErrorCode::OK)
+                throw std::runtime_error("ERROR: download failed: " + r.error.message);
+            else
+                throw std::runtime_error("ERROR: http download status code is " + std::to_string(r.status_code));
+        }
+
+        if (r.error.code == cpr::ErrorCode::OPERATION_TIMEDOUT)
+            prog.stalls++;
+        prog.retries++;
+        prog.waiting = true;
+
+        // wait 1, 2, 4, 8... seconds, up to 30
+        auto delay = std::chrono::seconds(std::min(1 << std::min(attempt, 5), 30));
+        auto resume_time = std::chrono::steady_clock::now() + delay;
+        printf("download of %s failed (%s), retry %i in %lli s\n", url.c_str(), r.error.message.c_str(), prog.retries, (long long)delay.count());
+
+        while (std::chrono::steady_clock::now() < resume_time)
+        {
+            if (!progress_callback(prog))
+                return transfer_result::canceled;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+    }
+}
+
+// download a release asset from the fastest mirror, failing over to the next
+// one if a mirror keeps failing. mirrors other than the last get only one retry.
+static transfer_result download_from_mirrors(
+    const std::string &upstream_url,
+    uint64_t &offset,
+    const std::function<bool(std::string_view data)> &write_callback,
+    const download::progress_callback_t &progress_callback
+)
+{
+    std::vector<std::string> mirrors = mirror::ranked();
+
+    for (size_t i = 0; i < mirrors.size(); i++)
+    {
+        bool is_last = i == mirrors.size() - 1;
+        std::string url = mirror::asset_url(mirrors[i], upstream_url);
+
+        try
+        {
+            return resumable_download(url, offset, is_last ? config::get().download_max_retries : 1, write_callback, progress_callback);
+        }
+        catch (std::runtime_error &e)
+        {
+            if (is_last) throw;
+
+            printf("mirror %s failed: %s\n", mirrors[i].c_str(), e.what());
+            mirror::report_failure(mirrors[i]);
+        }
+    }
+
+    throw std::runtime_error("ERROR: no mirrors available");
+}
+
+std::filesystem::path download::download_release(const ReleaseInfo &release, progress_callback_t progress_callback, sys::file_lock *archive_lock)
+{
+    std::string download_url = release_download_url(release);
+    std::filesystem::path download_archive_path = release_archive_path(release);
+
+    // download into a separate file first, so that an interrupted download
+    // never looks like a cached archive
+    std::filesystem::path part_path = download_archive_path;
+    part_path += ".part";
+
+    sys::file_lock own_lock;
+    if (!lock_release(release, archive_lock ? *archive_lock : own_lock, progress_callback)) return "";
+
+    // delete nightly cache, since it can change
+    if (!is_release_cached(release))
+    {
+        if (std::filesystem::exists(download_archive_path))
+            std::filesystem::remove(download_archive_path);
+
+        if (release.version_name == "Nightly" && std::filesystem::exists(part_path))
+            std::filesystem::remove(part_path);
+    }
+
+    if (!std::filesystem::exists(download_archive_path))
+    {
+        if (!progress_callback({ 0.0f, 0, 0, false })) return "";
+
+        // versioned release assets don't change, so a partial download left
+        // over from earlier can be resumed
+        uint64_t offset = 0;
+        if (std::filesystem::exists(part_path))
+            offset = std::filesystem::file_size(part_path);
+
+        std::ofstream ar_of(part_path, std::ios::binary | std::ios::app);
+        transfer_result result = download_from_mirrors(download_url, offset, [&](std::string_view data)
+        {
+            ar_of.write(data.data(), data.size());
+            return ar_of.good();
+        }, progress_callback);
+        ar_of.close();
+
+        if (result == transfer_result::canceled)
+        {
+            if (release.version_name == "Nightly")
+                std::filesystem::remove(part_path);
+            return "";
+        }
+
+        if (result == transfer_result::write_failed || ar_of.fail())
+        {
+            std::filesystem::remove(part_path);
+            throw std::runtime_error("ERROR: could not write " + part_path.u8string());
+        }
+
+        std::filesystem::rename(part_path, download_archive_path);
+        mark_release_fresh(release);
+        cache::record_miss(download_archive_path);
+    }
+    else
+    {
+        cache::record_hit(download_archive_path);
+    }
+
+    return download_archive_path;
+}
+
+// fetch the bytes [start, end) of a url into out
+static bool fetch_range(cpr::Session &session, const std::string &url, uint64_t start, uint64_t end, std::string &out)
+{
+    if (mirror::is_file_url(url))
+    {
+        std::ifstream stream(mirror::file_url_path(url), std::ios::binary);
+        stream.seekg(start);
+        out.resize(end - start);
+        stream.read(out.data(), out.size());
+        return (uint64_t)stream.gcount() == end - start;
+    }
+
+    session.SetRange(cpr::Range{ (int64_t)start, (int64_t)end - 1 });
+    cpr::Response r = session.Get();
+
+    // a server that ignores the range header responds with 200 and the whole
+    // file, in which case a plain download is simpler
+    if (r.status_code != 206 || r.text.size() != end - start)
+    {
+        printf("delta: range request failed with status %li\n", r.status_code);
+        return false;
+    }
+
+    out = std::move(r.text);
+    return true;
+}
+
+// find a block map for an asset, returning the url of the asset on the mirror
+// that had it, or an empty string if there is none
+static std::string fetch_block_map(const std::string &upstream_url, delta::block_map &out_map)
+{
+    // a locally generated block map takes precedence, mostly for testing
+    std::string asset_name = upstream_url.substr(upstream_url.find_last_of('/') + 1);
+    std::filesystem::path local_map_path = download::rainedvm_path() / (asset_name + ".blockmap");
+    if (std::filesystem::exists(local_map_path))
+    {
+        std::ifstream stream(local_map_path, std::ios::binary);
+        out_map = delta::read_block_map(stream);
+        return mirror::asset_url(mirror::ranked().front(), upstream_url);
+    }
+
+    for (auto &base : mirror::ranked())
+    {
+        std::string url = mirror::asset_url(base, upstream_url);
+        std::string map_data;
+
+        if (mirror::is_file_url(url))
+        {
+            std::ifstream stream(mirror::file_url_path(url + ".blockmap"), std::ios::binary);
+            if (!stream.is_open()) continue;
+            map_data.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        }
+        else
+        {
+            cpr::Response r = cpr::Get(
+                cpr::Url(url + ".blockmap"),
+                cpr::UserAgent(download::USER_AGENT)
+            );
+
+            if (r.status_code != 200) continue;
+            map_data = std::move(r.text);
+        }
+
+        std::istringstream stream(map_data);
+        out_map = delta::read_block_map(stream);
+        return url;
+    }
+
+    return "";
+}
+
+std::filesystem::path download::download_release_delta(const ReleaseInfo &release, progress_callback_t progress_callback, sys::file_lock *archive_lock)
+{
+    std::string download_url = release_download_url(release);
+    std::filesystem::path download_archive_path = release_archive_path(release);
+    std::filesystem::path part_path = download_archive_path;
+    part_path += ".part";
+
+    sys::file_lock own_lock;
+    if (!lock_release(release, archive_lock ? *archive_lock : own_lock, progress_callback)) return "";
+
+    if (is_release_cached(release))
+    {
+        cache::record_hit(download_archive_path);
+        return download_archive_path;
+    }
+
+    // the archive of the installed version is the best seed. an outdated nightly
+    // archive of the same name is also likely to share most of its blocks.
+    std::vector<std::filesystem::path> seeds;
+    std::filesystem::path cur_archive_path = rainedvm_path() / ("rained-current" ARCHIVE_EXT);
+    if (std::filesystem::exists(cur_archive_path))
+        seeds.push_back(cur_archive_path);
+    if (std::filesystem::exists(download_archive_path))
+        seeds.push_back(download_archive_path);
+
+    if (seeds.empty())
+        return "";
+
+    delta::block_map map;
+    std::vector<delta::block_source> sources;
+
+    try
+    {
+        download_url = fetch_block_map(download_url, map);
+        if (download_url.empty())
+            return "";
+
+        sources = delta::match_blocks(map, seeds);
+    }
+    catch (delta::delta_exception &e)
+    {
+        printf("delta: %s\n", e.what());
+        return "";
+    }
+
+    uint64_t missing_bytes = 0;
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        if (sources[i].seed < 0)
+            missing_bytes += map.size_of_block(i);
+    }
+
+    printf("delta: %llu of %llu bytes must be downloaded\n", (unsigned long long)missing_bytes, (unsigned long long)map.file_size);
+    if (missing_bytes == map.file_size)
+        return "";
+
+    if (!progress_callback({ 0.0f, 0, 0, false })) return "";
+
+    std::vector<std::ifstream> seed_streams;
+    for (auto &seed : seeds)
+        seed_streams.emplace_back(seed, std::ios::binary);
+
+    std::ofstream out(part_path, std::ios::binary | std::ios::trunc);
+    std::vector<char> buf(map.block_size);
+    uint64_t file_hash = 0xcbf29ce484222325ULL;
+    uint64_t bytes_fetched = 0;
+
+    config::settings cfg = config::get();
+
+    // one session, so that range requests reuse the connection
+    cpr::Session session;
+    session.SetUrl(cpr::Url(download_url));
+    session.SetUserAgent(cpr::UserAgent(USER_AGENT));
+    session.SetLowSpeed(cpr::LowSpeed(cfg.download_min_speed, cfg.download_stall_time));
+
+    size_t i = 0;
+    while (i < sources.size())
+    {
+        if (sources[i].seed >= 0)
+        {
+            uint32_t size = map.size_of_block(i);
+            std::ifstream &seed = seed_streams[sources[i].seed];
+            seed.seekg(sources[i].offset);
+            seed.read(buf.data(), size);
+
+            out.write(buf.data(), size);
+            file_hash = delta::hash64(buf.data(), size, file_hash);
+            i++;
+            continue;
+        }
+
+        // find the run of missing blocks starting here, also swallowing
+        // small runs of local blocks in between
+        size_t end = i + 1;
+        while (true)
+        {
+            size_t next = end;
+            while (next < sources.size() && sources[next].seed >= 0 && (next - end) * map.block_size < DELTA_MERGE_GAP)
+                next++;
+
+            if (next < sources.size() && sources[next].seed < 0)
+                end = next + 1;
+            else
+                break;
+        }
+
+        uint64_t range_start = (uint64_t)i * map.block_size;
+        uint64_t range_end = std::min<uint64_t>((uint64_t)end * map.block_size, map.file_size); // exclusive
+
+        std::string range_data;
+        if (!fetch_range(session, download_url, range_start, range_end, range_data))
+        {
+            out.close();
+            std::filesystem::remove(part_path);
+            return "";
+        }
+
+        for (size_t j = i; j < end; j++)
+        {
+            const char *block = range_data.data() + (j - i) * map.block_size;
+            uint32_t size = map.size_of_block(j);
+
+            if (delta::hash64(block, size) != map.blocks[j].strong)
+            {
+                out.close();
+                std::filesystem::remove(part_path);
+                throw std::runtime_error("ERROR: downloaded block does not match the block map");
+            }
+        }
+
+        out.write(range_data.data(), range_data.size());
+        file_hash = delta::hash64(range_data.data(), range_data.size(), file_hash);
+        bytes_fetched += range_data.size();
+        i = end;
+
+        if (!progress_callback({ (float)bytes_fetched / missing_bytes, 0, 0, false }))
+        {
+            out.close();
+            std::filesystem::remove(part_path);
+            return "";
+        }
+    }
+
+    out.close();
+    seed_streams.clear();
+
+    if (out.fail() || file_hash != map.file_hash)
+    {
+        std::filesystem::remove(part_path);
+        throw std::runtime_error("ERROR: assembled archive does not match the block map");
+    }
+
+    std::filesystem::rename(part_path, download_archive_path);
+    mark_release_fresh(release);
+    cache::record_miss(download_archive_path, map.file_size - bytes_fetched);
+    return download_archive_path;
+}
+
+bool download::can_stream_release(const ReleaseInfo &release)
+{
+#ifdef _WIN32
+    // the zip central directory is at the end of the file, so nothing can be
+    // extracted before the download finishes
+    (void)release;
+    return false;
+#else
+    // a partial download of the archive is resumed by download_release instead
+    std::filesystem::path part_path = release_archive_path(release);
+    part_path += ".part";
+
+    return !is_release_cached(release) && (release.version_name == "Nightly" || !std::filesystem::exists(part_path));
+#endif
+}
+
+std::filesystem::path download::download_release_streamed(
+    const ReleaseInfo &release,
+    const std::filesystem::path &staging_dir,
+    std::vector<std::filesystem::path> &out_files,
+    progress_callback_t progress_callback,
+    sys::file_lock *archive_lock
+)
+{
+    std::string download_url = release_download_url(release);
+    std::filesystem::path download_archive_path = release_archive_path(release);
+    std::filesystem::path part_path = download_archive_path;
+    part_path += ".part";
+
+    sys::file_lock own_lock;
+    if (!lock_release(release, archive_lock ? *archive_lock : own_lock, progress_callback)) return "";
+
+    std::filesystem::remove_all(staging_dir);
+    std::filesystem::create_directories(staging_dir);
+
+    if (is_release_cached(release))
+    {
+        auto ar = archive::open_release_archive(download_archive_path);
+        ar->extract_all(staging_dir);
+        out_files = ar->files();
+        cache::record_hit(download_archive_path);
+        return download_archive_path;
+    }
+
+    if (std::filesystem::exists(download_archive_path))
+        std::filesystem::remove(download_archive_path);
+
+    if (!progress_callback({ 0.0f, 0, 0, false })) return "";
+
+    // network thread -> compressed_queue -> inflate thread -> tar_queue -> extract thread
+    // the inflate thread also writes the compressed bytes to the cache, since
+    // the archive is needed later to uninstall this version.
+    util::bounded_queue<std::string> compressed_queue(PIPELINE_QUEUE_CAPACITY);
+    util::bounded_queue<std::string> tar_queue(PIPELINE_QUEUE_CAPACITY);
+    std::exception_ptr inflate_error;
+    std::exception_ptr extract_error;
+    std::atomic<bool> inflate_done = false;
+
+    std::ofstream ar_of(part_path, std::ios::binary);
+    archive::tar_stream_extractor extractor(staging_dir);
+
+    std::thread inflate_thread([&]()
+    {
+        try
+        {
+            archive::gzip_stream gz([&](const char *data, size_t size)
+            {
+                if (!tar_queue.push(std::string(data, size)))
+                    throw archive::archive_exception("extraction was aborted");
+            });
+
+            std::string chunk;
+            while (compressed_queue.pop(chunk))
+            {
+                ar_of.write(chunk.data(), chunk.size());
+                gz.write(chunk.data(), chunk.size());
+            }
+
+            gz.finish();
+            inflate_done = true;
+        }
+        catch (...)
+        {
+            inflate_error = std::current_exception();
+            compressed_queue.close();
+        }
+
+        tar_queue.close();
+    });
+
+    std::thread extract_thread([&]()
+    {
+        try
+        {
+            std::string chunk;
+            while (tar_queue.pop(chunk))
+                extractor.write(chunk.data(), chunk.size());
+
+            // if decompression failed, report that error instead of the truncation
+            if (inflate_done)
+                extractor.finish();
+        }
+        catch (...)
+        {
+            extract_error = std::current_exception();
+            tar_queue.close();
+        }
+    });
+
+    transfer_result result = transfer_result::done;
+    std::exception_ptr network_error;
+
+    try
+    {
+        // fails if a later stage hit an error
+        uint64_t offset = 0;
+        result = download_from_mirrors(download_url, offset, [&](std::string_view data)
+        {
+            return compressed_queue.push(std::string(data));
+        }, progress_callback);
+    }
+    catch (...)
+    {
+        network_error = std::current_exception();
+    }
+
+    compressed_queue.close();
+    inflate_thread.join();
+    extract_thread.join();
+    ar_of.close();
+
+    bool canceled = result == transfer_result::canceled;
+    if (canceled || network_error || inflate_error || extract_error || ar_of.fail())
+    {
+        std::filesystem::remove(part_path);
+        std::filesystem::remove_all(staging_dir);
+
+        if (canceled)
+            return "";
+
+        if (network_error)
+            std::rethrow_exception(network_error);
+
+        // check extraction first: if it failed, the inflate thread only
+        // reports that it could not pass data along
+        if (extract_error)
+            std::rethrow_exception(extract_error);
+
+        if (inflate_error)
+            std::rethrow_exception(inflate_error);
+
+        throw std::runtime_error("ERROR: could not write " + download_archive_path.u8string());
+    }
+
+    std::filesystem::rename(part_path, download_archive_path);
+    out_files = extractor.files();
+    mark_release_fresh(release);
+    cache::record_miss(download_archive_path);
+    return download_archive_path;
+}
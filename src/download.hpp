@@ -0,0 +1,130 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <vector>
+#include "release.hpp"
+
+namespace sys
+{
+    class file_lock;
+}
+
+#if _WIN32
+#define ARCHIVE_EXT ".zip"
+#else
+#define ARCHIVE_EXT ".tar.gz"
+#endif
+
+namespace download
+{
+    extern const char *USER_AGENT;
+
+    /**
+    * Progress of a download, passed to progress callbacks.
+    **/
+    struct progress
+    {
+        // fraction of the download that is done
+        float fraction;
+
+        // number of times the transfer was restarted after an error
+        int retries;
+
+        // number of times the transfer fell below the minimum speed
+        int stalls;
+
+        // true while waiting to retry after an error
+        bool waiting;
+    };
+
+    /**
+    * Returns false to cancel the download.
+    **/
+    typedef std::function<bool(const progress&)> progress_callback_t;
+
+    /**
+    * Get the path of the .rainedvm directory, creating it if it doesn't exist.
+    **/
+    const std::filesystem::path rainedvm_path();
+
+    /**
+    * Get the directory release archives are cached in, creating it if it doesn't
+    * exist. This is .rainedvm, unless the shared_cache setting is enabled, in which
+    * case it is shared by every installation of the user: $XDG_CACHE_HOME/rainedvm
+    * or ~/.cache/rainedvm on Linux, %LOCALAPPDATA%\rainedvm\cache on Windows.
+    *
+    * Downloads of a release hold a lock on <archive>.lock in this directory, so
+    * when several instances want the same release, one downloads it and the
+    * others wait for it, then use the archive it left. The download functions
+    * take an optional archive_lock, which they leave holding the lock when
+    * they return, so that the cache doesn't evict the archive while it is
+    * still being used. The caller releases it when it is done.
+    **/
+    const std::filesystem::path cache_path();
+
+    /**
+    * Take the lock on the archive of a release that the download functions
+    * take, waiting while another instance downloads it. progress_callback
+    * returns false to stop waiting, in which case false is returned.
+    **/
+    bool lock_release(const ReleaseInfo &release, sys::file_lock &lock, progress_callback_t progress_callback);
+
+    /**
+    * Take the lock on the cached archive of a release, and return its path
+    * without downloading anything, so the release needs no download URL.
+    * Returns an empty path, without holding the lock, if the archive isn't
+    * cached or progress_callback stopped the wait.
+    **/
+    std::filesystem::path lock_cached_release(const ReleaseInfo &release, sys::file_lock &lock, progress_callback_t progress_callback);
+
+    /**
+    * Download the archive for a release into the cache, unless it is already cached.
+    * progress_callback returns false to cancel the download, in which case an
+    * empty path is returned.
+    *
+    * If the connection drops or stalls, the download is retried with exponential
+    * backoff, resuming from the bytes already received. A canceled download of a
+    * versioned release is kept as a .part file and resumed next time.
+    **/
+    std::filesystem::path download_release(const ReleaseInfo &release, progress_callback_t progress_callback, sys::file_lock *archive_lock = nullptr);
+
+    /**
+    * Returns true if the archive for a release is already cached. Nightly
+    * archives never count as cached, since the nightly release can change.
+    **/
+    bool is_release_cached(const ReleaseInfo &release);
+
+    /**
+    * Try to assemble the archive for a release out of blocks of archives that are
+    * already cached, fetching only the byte ranges that are missing. This needs a
+    * block map of the asset, published next to it as <asset url>.blockmap, or
+    * placed in .rainedvm as <asset file name>.blockmap for testing.
+    * If another instance downloaded the archive meanwhile, that one is returned.
+    * Returns an empty path if no delta could be made or the download was canceled.
+    **/
+    std::filesystem::path download_release_delta(const ReleaseInfo &release, progress_callback_t progress_callback, sys::file_lock *archive_lock = nullptr);
+
+    /**
+    * Returns true if download_release_streamed can be used for this release, i.e.
+    * the platform's archive format can be extracted as it arrives, and the archive
+    * is neither cached nor partially downloaded.
+    **/
+    bool can_stream_release(const ReleaseInfo &release);
+
+    /**
+    * Download the archive for a release into the cache while simultaneously
+    * extracting it into staging_dir. The network, decompression and extraction
+    * stages run on separate threads connected by bounded queues. The paths of
+    * the extracted files, relative to staging_dir, are written to out_files.
+    * If another instance downloaded the archive meanwhile, that one is
+    * extracted instead.
+    **/
+    std::filesystem::path download_release_streamed(
+        const ReleaseInfo &release,
+        const std::filesystem::path &staging_dir,
+        std::vector<std::filesystem::path> &out_files,
+        progress_callback_t progress_callback,
+        sys::file_lock *archive_lock = nullptr
+    );
+}
@@ -0,0 +1,155 @@
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include "installed.hpp"
+#include "download.hpp"
+#include "sys.hpp"
+#include "json.hpp"
+
+using namespace nlohmann;
+
+// a .NET app's first start can be slow on a cold disk, but not this slow
+constexpr int VERSION_QUERY_TIMEOUT_MS = 30000;
+
+static std::filesystem::path record_path()
+{
+    return download::rainedvm_path() / "installed.json";
+}
+
+// get the identity of the files that make up a rained installation. rained is
+// a .NET app, so the executable may be a launcher that is identical across
+// versions; the main assembly next to it is included too.
+static bool installation_key(const std::filesystem::path &rained_dir, json &out_key)
+{
+    out_key = json::array();
+
+    for (const char *file_name : { "Rained", "Rained.exe", "Rained.dll" })
+    {
+        std::filesystem::path path = rained_dir / file_name;
+        std::error_code ec;
+        if (!std::filesystem::is_regular_file(path, ec))
+            continue;
+
+        std::filesystem::path abs_path = std::filesystem::absolute(path, ec);
+        if (ec) return false;
+
+        auto size = std::filesystem::file_size(path, ec);
+        if (ec) return false;
+
+        auto mtime = std::filesystem::last_write_time(path, ec);
+        if (ec) return false;
+
+        uint64_t index;
+        if (!sys::file_index(path, index))
+            return false;
+
+        out_key.push_back({
+            { "path", abs_path.u8string() },
+            { "size", size },
+            { "mtime", (int64_t) mtime.time_since_epoch().count() },
+            { "index", index }
+        });
+    }
+
+    return !out_key.empty();
+}
+
+static void write_record(const json &key, const std::string &version)
+{
+    json data;
+    data["key"] = key;
+    data["version"] = version;
+
+    std::ofstream stream(record_path());
+    stream << data.dump(4);
+}
+
+// ask the rained executable for its version
+static bool run_version_query(const std::filesystem::path &rained_path, std::string &version)
+{
+    std::filesystem::path rained_exe_path = rained_path / "Rained";
+
+    std::vector<std::string> argv = { rained_exe_path.u8string() };
+#if _WIN32
+    argv.push_back("--console");
+#endif
+    argv.push_back("--version");
+
+    std::string res;
+    sys::spawn_options options;
+    options.on_output = [&](const char *data, size_t size) { res.append(data, size); };
+    options.timeout_ms = VERSION_QUERY_TIMEOUT_MS;
+
+    try
+    {
+        if (sys::spawn(argv, options) != 0)
+            return false;
+    }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "could not query Rained version: %s\n", e.what());
+        return false;
+    }
+
+    if (res.substr(0, 7) != "Rained ")
+        return false;
+
+    version = res.substr(7);
+
+    // trim whitespace at end
+    for (auto it = version.rbegin(); it != version.rend(); it++)
+    {
+        if (!std::isspace(*it))
+        {
+            version.erase(it.base(), version.end());
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool installed::get_version(const std::filesystem::path &rained_dir, std::string &version)
+{
+    json key;
+    bool has_key = installation_key(rained_dir, key);
+
+    if (has_key)
+    {
+        std::ifstream stream(record_path());
+        if (stream.is_open())
+        {
+            try
+            {
+                json data = json::parse(stream);
+                if (data.at("key") == key)
+                {
+                    version = data.at("version");
+                    return true;
+                }
+            }
+            catch (json::exception &e)
+            {
+                fprintf(stderr, "could not read installed.json: %s\n", e.what());
+            }
+        }
+    }
+
+    printf("rained changed, querying its version\n");
+    if (!run_version_query(rained_dir, version))
+        return false;
+
+    if (has_key)
+        write_record(key, version);
+
+    return true;
+}
+
+void installed::record_version(const std::filesystem::path &rained_dir, const std::string &version)
+{
+    json key;
+    if (installation_key(rained_dir, key))
+        write_record(key, version);
+    else
+        std::filesystem::remove(record_path());
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+/**
+* Tracks the version of the Rained installation, so that Rained doesn't have
+* to be started just to ask it for its version. The version is kept in
+* .rainedvm/installed.json along with the identity of the executable it
+* belongs to: its path, size, modification time and file index.
+**/
+namespace installed
+{
+    /**
+    * Get the version of the Rained installation in rained_dir. The recorded
+    * version is used if the executable is unchanged since it was recorded.
+    * Otherwise, Rained is run with --version, and the result is recorded.
+    **/
+    bool get_version(const std::filesystem::path &rained_dir, std::string &version);
+
+    /**
+    * Record the version of a Rained installation that was just installed.
+    **/
+    void record_version(const std::filesystem::path &rained_dir, const std::string &version);
+}
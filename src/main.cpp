@@ -4,6 +4,7 @@
 
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <imgui.h>
 #include <imgui_internal.h>
 #include <backends/imgui_impl_glfw.h>
@@ -14,6 +15,9 @@
 #include "app.hpp"
 #include "sys.hpp"
 #include "sys_args_internal.hpp"
+#include "delta.hpp"
+#include "cli.hpp"
+#include "util.hpp"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -25,6 +29,12 @@ static void glfw_error_callback(int error, const char* description)
     fprintf(stderr, "GLFW Error %d: %s\n", error, description);
 }
 
+// frames drawn after the loop wakes up, before it goes idle again
+constexpr int ACTIVE_FRAMES = 3;
+
+// seconds an idle loop waits for events before drawing a frame anyway
+constexpr double IDLE_TIMEOUT = 1.0;
+
 static bool init_window_pos = true;
 static Application *application = nullptr;
 
@@ -66,8 +76,36 @@ void frame(GLFWwindow *window)
     }
 }
 
+// write <file>.blockmap next to a release asset, so that clients can download
+// it as a delta against the archives they already have
+static int generate_block_map(const std::string &file_path)
+{
+    try
+    {
+        delta::block_map map = delta::generate_block_map(std::filesystem::u8path(file_path));
+        std::ofstream stream(std::filesystem::u8path(file_path + ".blockmap"), std::ios::binary);
+        delta::write_block_map(map, stream);
+        printf("wrote %zu blocks to %s.blockmap\n", map.blocks.size(), file_path.c_str());
+    }
+    catch (std::exception &e)
+    {
+        fprintf(stderr, "error: %s\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
+
 int entry()
 {
+    auto &args = sys::arguments();
+    if (args.size() == 3 && args[1] == "--gen-blockmap")
+        return generate_block_map(args[2]);
+
+    // commands don't need a window, so they work without a display
+    if (cli::is_command(args))
+        return cli::run(args);
+
     glfwSetErrorCallback(glfw_error_callback);
     if (!glfwInit())
         return 1;
@@ -139,7 +177,9 @@ int entry()
         io.FontDefault = font;
     }
 
+    util::set_wake_handler(glfwPostEmptyEvent);
     application = new Application;
+    int active_frames = ACTIVE_FRAMES;
 
 #if !defined(USE_IMGUI_VIEWPORTS)
     glfwShowWindow(window);
@@ -152,10 +192,27 @@ int entry()
         // - When io.WantCaptureMouse is true, do not dispatch mouse input data to your main application, or clear/overwrite your copy of the mouse data.
         // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application, or clear/overwrite your copy of the keyboard data.
         // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
-        glfwPollEvents();
+        //
+        // Nothing is drawn while the window just sits there. the loop runs at
+        // full rate only while something animates or the user is interacting,
+        // and otherwise sleeps until an input event arrives or a background
+        // task wakes it with util::wake_main_loop.
+        if (active_frames > 0 || application->is_animating() || io.WantTextInput)
+        {
+            glfwPollEvents();
+            if (active_frames > 0) active_frames--;
+        }
+        else
+        {
+            glfwWaitEventsTimeout(IDLE_TIMEOUT);
+
+            // imgui needs a few frames to react to input
+            active_frames = ACTIVE_FRAMES;
+        }
+
         if (glfwGetWindowAttrib(window, GLFW_ICONIFIED) != 0)
         {
-            ImGui_ImplGlfw_Sleep(10);
+            glfwWaitEvents();
             continue;
         }
 
@@ -188,6 +245,7 @@ int entry()
         glfwSwapBuffers(window);
     }
 
+    util::set_wake_handler(nullptr);
     delete application;
 
     // Cleanup
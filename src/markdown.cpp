@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cctype>
+#include "markdown.hpp"
+
+static bool is_space(char c)
+{
+    return std::isspace((unsigned char) c) != 0;
+}
+
+// three or more of the same *, - or _, optionally separated by spaces
+static bool is_rule(const char *begin, const char *end)
+{
+    char mark = *begin;
+    if (mark != '*' && mark != '-' && mark != '_')
+        return false;
+
+    int count = 0;
+    for (const char *p = begin; p < end; p++)
+    {
+        if (*p == mark) count++;
+        else if (*p != ' ') return false;
+    }
+
+    return count >= 3;
+}
+
+markdown::document::document(const std::string &markdown)
+{
+    const char *p = markdown.data();
+    const char *end = p + markdown.size();
+
+    while (p < end)
+    {
+        const char *line_end = std::find(p, end, '\n');
+        const char *next = line_end == end ? end : line_end + 1;
+
+        if (line_end > p && line_end[-1] == '\r')
+            line_end--;
+
+        parse_line(p, line_end);
+        p = next;
+    }
+}
+
+void markdown::document::parse_line(const char *begin, const char *end)
+{
+    // two spaces per indent level
+    int spaces = 0;
+    const char *p = begin;
+    while (p < end && (*p == ' ' || *p == '\t'))
+    {
+        spaces += *p == '\t' ? 4 : 1;
+        p++;
+    }
+
+    block b { block_type::text, spaces / 2, {} };
+
+    if (p == end)
+    {
+        b.type = block_type::blank;
+    }
+    else if (*p == '#')
+    {
+        const char *text = p;
+        while (text < end && *text == '#') text++;
+
+        if (text == end || *text == ' ')
+        {
+            b.type = block_type::heading;
+            while (text < end && *text == ' ') text++;
+            p = text;
+        }
+    }
+    else if (is_rule(p, end))
+    {
+        b.type = block_type::rule;
+        p = end;
+    }
+    else if ((*p == '-' || *p == '*' || *p == '+') && p + 1 < end && p[1] == ' ')
+    {
+        b.type = block_type::list_item;
+        p += 2;
+    }
+
+    parse_spans(p, end, b.spans);
+    _blocks.push_back(std::move(b));
+}
+
+void markdown::document::parse_spans(const char *begin, const char *end, std::vector<span> &out_spans)
+{
+    bool emphasis = false;
+    bool strong = false;
+
+    size_t span_start = _text.size();
+    span_style cur_style = span_style::normal;
+    int cur_link = -1;
+
+    // end the current span, and start one with a different style
+    auto set_style = [&](span_style style, int link)
+    {
+        if (_text.size() > span_start)
+            out_spans.push_back({ span_start, _text.size() - span_start, cur_style, cur_link });
+
+        span_start = _text.size();
+        cur_style = style;
+        cur_link = link;
+    };
+
+    auto text_style = [&]()
+    {
+        if (strong) return span_style::strong;
+        if (emphasis) return span_style::emphasis;
+        return span_style::normal;
+    };
+
+    const char *p = begin;
+    while (p < end)
+    {
+        char c = *p;
+
+        // escaped character
+        if (c == '\\' && p + 1 < end && std::ispunct((unsigned char) p[1]))
+        {
+            _text += p[1];
+            p += 2;
+            continue;
+        }
+
+        // code is shown as is
+        if (c == '`')
+        {
+            const char *close = std::find(p + 1, end, '`');
+            if (close != end)
+            {
+                _text.append(p + 1, close);
+                p = close + 1;
+                continue;
+            }
+        }
+
+        // [text](url), or ![alt text](url) for images
+        if (c == '[' || (c == '!' && p + 1 < end && p[1] == '['))
+        {
+            bool is_image = c == '!';
+            const char *text_begin = p + (is_image ? 2 : 1);
+            const char *text_end = std::find(text_begin, end, ']');
+
+            if (text_end != end && text_end + 1 < end && text_end[1] == '(')
+            {
+                const char *url_begin = text_end + 2;
+                const char *url_end = std::find(url_begin, end, ')');
+
+                if (url_end != end)
+                {
+                    // images aren't shown, only their alt text
+                    if (is_image)
+                    {
+                        _text.append(text_begin, text_end);
+                    }
+                    else
+                    {
+                        _links.emplace_back(url_begin, url_end);
+                        set_style(span_style::link, (int)_links.size() - 1);
+                        _text.append(text_begin, text_end);
+                        set_style(text_style(), -1);
+                    }
+
+                    p = url_end + 1;
+                    continue;
+                }
+            }
+        }
+
+        // *emphasis* and **strong emphasis**. an underscore inside a word is
+        // just an underscore, and so is a marker next to whitespace.
+        if (c == '*' || c == '_')
+        {
+            bool is_double = p + 1 < end && p[1] == c;
+            int marker_len = is_double ? 2 : 1;
+            char before = p > begin ? p[-1] : ' ';
+            char after = p + marker_len < end ? p[marker_len] : ' ';
+
+            bool can_open = !is_space(after) && (c == '*' || !std::isalnum((unsigned char) before));
+            bool can_close = !is_space(before) && (c == '*' || !std::isalnum((unsigned char) after));
+
+            bool &flag = is_double ? strong : emphasis;
+            if (flag ? can_close : can_open)
+            {
+                flag = !flag;
+                set_style(text_style(), -1);
+                p += marker_len;
+                continue;
+            }
+        }
+
+        _text += c;
+        p++;
+    }
+
+    set_style(span_style::normal, -1);
+}
+
+void markdown::document::layout(float wrap_width)
+{
+    _lines.clear();
+
+    ImGuiStyle &style = ImGui::GetStyle();
+    float font_size = ImGui::GetFontSize();
+    float line_height = ImGui::GetTextLineHeightWithSpacing();
+    float indent_width = style.IndentSpacing * 0.5f;
+    float bullet_width = ImGui::GetTreeNodeToLabelSpacing();
+    float y = 0.0f;
+
+    auto new_line = [&](float height) -> line&
+    {
+        _lines.push_back({ y, height, {}, -1.0f, -1.0f });
+        y += height;
+        return _lines.back();
+    };
+
+    // place text on a line, merging it with the previous run of the same span
+    auto add_run = [&](line &l, float x, float width, const char *begin, const char *end, const span &sp)
+    {
+        size_t start = begin - _text.data();
+        if (!l.runs.empty())
+        {
+            run &last = l.runs.back();
+            if (last.start + last.length == start && last.style == sp.style && last.link == sp.link)
+            {
+                last.length += end - begin;
+                last.width += width;
+                return;
+            }
+        }
+
+        l.runs.push_back({ x, width, start, (size_t)(end - begin), sp.style, sp.link });
+    };
+
+    for (const block &b : _blocks)
+    {
+        if (b.type == block_type::blank)
+        {
+            y += line_height;
+            continue;
+        }
+
+        if (b.type == block_type::rule)
+        {
+            new_line(line_height).separator_y = line_height * 0.5f;
+            continue;
+        }
+
+        // headings have an empty line above them
+        if (b.type == block_type::heading)
+            y += line_height;
+
+        float left = b.indent * indent_width;
+        line *cur = &new_line(line_height);
+
+        if (b.type == block_type::list_item)
+        {
+            cur->bullet_x = left + style.FramePadding.x + font_size * 0.5f;
+            left += bullet_width;
+        }
+
+        float x = left;
+        for (const span &sp : b.spans)
+        {
+            const char *s = _text.data() + sp.start;
+            const char *s_end = s + sp.length;
+
+            while (s < s_end)
+            {
+                // the next word, and the spaces after it
+                const char *word_end = s;
+                while (word_end < s_end && *word_end != ' ') word_end++;
+                const char *space_end = word_end;
+                while (space_end < s_end && *space_end == ' ') space_end++;
+
+                float word_width = ImGui::CalcTextSize(s, word_end).x;
+                if (x + word_width > wrap_width && x > left)
+                {
+                    cur = &new_line(line_height);
+                    x = left;
+                }
+
+                // a word wider than the whole line is broken between characters
+                if (x + word_width > wrap_width && word_end - s > 1)
+                {
+                    const char *fit = s + 1;
+                    while (fit < word_end && x + ImGui::CalcTextSize(s, fit + 1).x <= wrap_width)
+                        fit++;
+
+                    add_run(*cur, x, ImGui::CalcTextSize(s, fit).x, s, fit, sp);
+                    cur = &new_line(line_height);
+                    x = left;
+                    s = fit;
+                    continue;
+                }
+
+                float width = ImGui::CalcTextSize(s, space_end).x;
+                add_run(*cur, x, width, s, space_end, sp);
+                x += width;
+                s = space_end;
+            }
+        }
+
+        // and a separator and an empty line below them
+        if (b.type == block_type::heading)
+        {
+            new_line(style.ItemSpacing.y).separator_y = style.ItemSpacing.y * 0.5f;
+            y += line_height;
+        }
+    }
+
+    _height = y;
+}
+
+void markdown::document::render(float wrap_width, const link_callback_t &link_callback)
+{
+    if (wrap_width != _layout_width || ImGui::GetFont() != _layout_font || ImGui::GetFontSize() != _layout_font_size)
+    {
+        layout(wrap_width);
+        _layout_width = wrap_width;
+        _layout_font = ImGui::GetFont();
+        _layout_font_size = ImGui::GetFontSize();
+    }
+
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImDrawList *draw_list = ImGui::GetWindowDrawList();
+    float clip_top = draw_list->GetClipRectMin().y - origin.y;
+    float clip_bottom = draw_list->GetClipRectMax().y - origin.y;
+
+    // lines are sorted by y, so the visible ones are found without looking at the rest
+    auto first = std::partition_point(_lines.begin(), _lines.end(), [&](const line &l) { return l.y + l.height < clip_top; });
+    auto last = std::partition_point(first, _lines.end(), [&](const line &l) { return l.y <= clip_bottom; });
+
+    float text_height = ImGui::GetTextLineHeight();
+
+    // find the hovered link first, so that all of its pieces are underlined alike
+    int hovered_link = -1;
+    if (ImGui::IsWindowHovered())
+    {
+        for (auto it = first; it != last && hovered_link < 0; it++)
+        {
+            for (const run &r : it->runs)
+            {
+                if (r.link < 0) continue;
+
+                ImVec2 min(origin.x + r.x, origin.y + it->y);
+                ImVec2 max(min.x + r.width, min.y + text_height);
+                if (ImGui::IsMouseHoveringRect(min, max))
+                {
+                    hovered_link = r.link;
+                    break;
+                }
+            }
+        }
+    }
+
+    ImU32 text_col = ImGui::GetColorU32(ImGuiCol_Text);
+    ImU32 disabled_col = ImGui::GetColorU32(ImGuiCol_TextDisabled);
+    ImU32 link_col = ImGui::GetColorU32(ImGuiCol_ButtonHovered);
+    ImU32 underline_col = ImGui::GetColorU32(ImGuiCol_Button);
+    ImU32 separator_col = ImGui::GetColorU32(ImGuiCol_Separator);
+
+    for (auto it = first; it != last; it++)
+    {
+        ImVec2 pos(origin.x, origin.y + it->y);
+
+        if (it->bullet_x >= 0.0f)
+            draw_list->AddCircleFilled(ImVec2(pos.x + it->bullet_x, pos.y + text_height * 0.5f), ImGui::GetFontSize() * 0.20f, text_col);
+
+        if (it->separator_y >= 0.0f)
+            draw_list->AddLine(ImVec2(pos.x, pos.y + it->separator_y), ImVec2(pos.x + wrap_width, pos.y + it->separator_y), separator_col);
+
+        for (const run &r : it->runs)
+        {
+            const char *begin = _text.data() + r.start;
+            ImU32 col = r.style == span_style::link ? link_col : r.style == span_style::emphasis ? disabled_col : text_col;
+            draw_list->AddText(ImVec2(pos.x + r.x, pos.y), col, begin, begin + r.length);
+
+            if (r.style == span_style::link)
+            {
+                float underline_y = pos.y + text_height;
+                draw_list->AddLine(ImVec2(pos.x + r.x, underline_y), ImVec2(pos.x + r.x + r.width, underline_y), r.link == hovered_link ? link_col : underline_col);
+            }
+        }
+    }
+
+    if (hovered_link >= 0)
+    {
+        const std::string &url = _links[hovered_link];
+        ImGui::SetMouseCursor(ImGuiMouseCursor_Hand);
+        ImGui::SetTooltip("%s", url.c_str());
+
+        if (ImGui::IsMouseClicked(0))
+            link_callback(url);
+    }
+
+    ImGui::Dummy(ImVec2(wrap_width, _height));
+}
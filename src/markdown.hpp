@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <imgui.h>
+
+namespace markdown
+{
+    typedef std::function<void(const std::string &url)> link_callback_t;
+
+    /**
+    * A markdown document for display with ImGui. The text is parsed once into
+    * blocks and spans, then laid out into lines for a wrap width and font. The
+    * layout is kept until the width or font changes, so drawing a frame only
+    * replays the lines that are visible in the window.
+    *
+    * Supports headings, unordered lists, indentation, horizontal rules,
+    * *emphasis*, **strong emphasis**, `code` and [links](url). As with
+    * imgui_markdown, every line of the source is a line of its own.
+    **/
+    class document
+    {
+    private:
+        enum class span_style
+        {
+            normal,
+            emphasis,
+            strong,
+            link
+        };
+
+        // a piece of _text with one style
+        struct span
+        {
+            size_t start;
+            size_t length;
+            span_style style;
+            int link; // index into _links, or -1
+        };
+
+        enum class block_type
+        {
+            text,
+            heading,
+            list_item,
+            rule,
+            blank
+        };
+
+        // a line of the source
+        struct block
+        {
+            block_type type;
+            int indent;
+            std::vector<span> spans;
+        };
+
+        // a piece of a span that was placed on a line
+        struct run
+        {
+            float x;
+            float width;
+            size_t start;
+            size_t length;
+            span_style style;
+            int link;
+        };
+
+        struct line
+        {
+            float y;
+            float height;
+            std::vector<run> runs;
+
+            // negative if the line has no bullet or separator
+            float bullet_x;
+            float separator_y;
+        };
+
+        // the text of all spans, with markup removed
+        std::string _text;
+        std::vector<std::string> _links;
+        std::vector<block> _blocks;
+
+        // the layout, and what it was made for
+        std::vector<line> _lines;
+        float _height = 0.0f;
+        float _layout_width = -1.0f;
+        ImFont *_layout_font = nullptr;
+        float _layout_font_size = 0.0f;
+
+        void parse_line(const char *begin, const char *end);
+        void parse_spans(const char *begin, const char *end, std::vector<span> &out_spans);
+        void layout(float wrap_width);
+
+    public:
+        document(const std::string &markdown);
+
+        /**
+        * Draw the document at the cursor position, wrapping lines at wrap_width.
+        * link_callback is called when a link is clicked.
+        **/
+        void render(float wrap_width, const link_callback_t &link_callback);
+    };
+}
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <cpr/cpr.h>
+#include "mirror.hpp"
+#include "config.hpp"
+#include "download.hpp"
+
+const char *mirror::GITHUB_API_URL = "https://api.github.com/repos/pkhead/rained";
+
+// a mirror that takes longer than this to answer the probe is skipped
+constexpr int PROBE_TIMEOUT_MS = 2000;
+
+static std::mutex ranked_mutex;
+static bool ranked_init = false;
+static std::vector<std::string> ranked_mirrors;
+
+static std::string trim_slash(std::string url)
+{
+    while (!url.empty() && url.back() == '/')
+        url.pop_back();
+    return url;
+}
+
+bool mirror::is_github(const std::string &base_url)
+{
+    return base_url == GITHUB_API_URL;
+}
+
+bool mirror::is_file_url(const std::string &url)
+{
+    return url.substr(0, 7) == "file://";
+}
+
+std::filesystem::path mirror::file_url_path(const std::string &url)
+{
+    std::string path = url.substr(7);
+
+    // decode percent escapes
+    std::string decoded;
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        if (path[i] == '%' && i + 2 < path.size())
+        {
+            decoded.push_back((char)std::strtol(path.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+        }
+        else
+        {
+            decoded.push_back(path[i]);
+        }
+    }
+
+#ifdef _WIN32
+    // file:///C:/dir -> C:/dir
+    if (decoded.size() >= 3 && decoded[0] == '/' && decoded[2] == ':')
+        decoded.erase(0, 1);
+#endif
+
+    return std::filesystem::u8path(decoded);
+}
+
+std::string mirror::releases_url(const std::string &base_url)
+{
+    if (is_github(base_url))
+        return base_url + "/releases";
+    return base_url + "/releases.json";
+}
+
+std::string mirror::nightly_url(const std::string &base_url)
+{
+    if (is_github(base_url))
+        return base_url + "/releases/tags/nightly";
+    return base_url + "/nightly.json";
+}
+
+std::string mirror::asset_url(const std::string &base_url, const std::string &upstream_url)
+{
+    if (is_github(base_url))
+        return upstream_url;
+
+    // https://github.com/pkhead/rained/releases/download/<tag>/<asset>
+    const std::string marker = "/releases/download/";
+    size_t pos = upstream_url.find(marker);
+    std::string tail;
+    if (pos != std::string::npos)
+    {
+        tail = upstream_url.substr(pos + marker.size());
+    }
+    else
+    {
+        // fall back to the last two path components
+        size_t last = upstream_url.find_last_of('/');
+        size_t second = (last == std::string::npos || last == 0) ? std::string::npos : upstream_url.find_last_of('/', last - 1);
+        tail = upstream_url.substr(second == std::string::npos ? 0 : second + 1);
+    }
+
+    return base_url + "/download/" + tail;
+}
+
+// returns the round-trip time in seconds, or a negative value if the mirror is unusable
+static double probe_mirror(const std::string &base_url)
+{
+    if (mirror::is_file_url(base_url))
+    {
+        std::error_code ec;
+        return std::filesystem::is_directory(mirror::file_url_path(base_url), ec) ? 0.0 : -1.0;
+    }
+
+    cpr::Response r = cpr::Head(
+        cpr::Url(mirror::releases_url(base_url)),
+        cpr::UserAgent(download::USER_AGENT),
+        cpr::Timeout(PROBE_TIMEOUT_MS)
+    );
+
+    if (r.error.code != cpr::ErrorCode::OK || r.status_code >= 400)
+        return -1.0;
+
+    return r.elapsed;
+}
+
+std::vector<std::string> mirror::ranked()
+{
+    std::lock_guard lock(ranked_mutex);
+
+    if (!ranked_init)
+    {
+        ranked_init = true;
+
+        config::settings cfg = config::get();
+        std::vector<std::string> bases;
+        for (auto &url : cfg.mirrors)
+            bases.push_back(trim_slash(url));
+
+        // probe all mirrors at once
+        std::vector<double> latency(bases.size(), -1.0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < bases.size(); i++)
+            threads.emplace_back([&, i]() { latency[i] = probe_mirror(bases[i]); });
+
+        for (auto &thread : threads)
+            thread.join();
+
+        std::vector<size_t> order;
+        for (size_t i = 0; i < bases.size(); i++)
+        {
+            printf("mirror %s: %s\n", bases[i].c_str(), latency[i] < 0.0 ? "unreachable" : std::to_string(latency[i]).c_str());
+            if (latency[i] >= 0.0)
+                order.push_back(i);
+        }
+
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return latency[a] < latency[b]; });
+
+        for (size_t i : order)
+            ranked_mirrors.push_back(bases[i]);
+        ranked_mirrors.push_back(GITHUB_API_URL);
+    }
+
+    return ranked_mirrors;
+}
+
+void mirror::report_failure(const std::string &base_url)
+{
+    std::lock_guard lock(ranked_mutex);
+
+    // github stays last, behind every mirror, since it gets the most retries
+    auto github = std::find(ranked_mirrors.begin(), ranked_mirrors.end(), GITHUB_API_URL);
+    auto it = std::find(ranked_mirrors.begin(), github, base_url);
+    if (it != github)
+        std::rotate(it, it + 1, github);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+* Release metadata and assets can be served by mirrors listed in config.json,
+* in addition to GitHub. A mirror is a base URL, which can be a file:// directory,
+* with this layout:
+*
+*   <base>/releases.json            - response of GitHub's /repos/pkhead/rained/releases
+*   <base>/nightly.json             - response of /repos/pkhead/rained/releases/tags/nightly
+*   <base>/download/<tag>/<asset>   - release assets, and optionally their .blockmap files
+*
+* Mirrors are probed once, then tried fastest first. GitHub is always tried last.
+**/
+namespace mirror
+{
+    extern const char *GITHUB_API_URL;
+
+    /**
+    * Get the base URLs of all mirrors, in the order they should be tried.
+    * The first call probes every configured mirror and may block for a moment.
+    **/
+    std::vector<std::string> ranked();
+
+    /**
+    * Move a mirror behind the other mirrors after a failed request. GitHub
+    * stays at the end of the list.
+    **/
+    void report_failure(const std::string &base_url);
+
+    bool is_github(const std::string &base_url);
+    std::string releases_url(const std::string &base_url);
+    std::string nightly_url(const std::string &base_url);
+
+    /**
+    * Get the URL of a release asset on a mirror, given its GitHub download URL.
+    **/
+    std::string asset_url(const std::string &base_url, const std::string &upstream_url);
+
+    bool is_file_url(const std::string &url);
+
+    /**
+    * Convert a file:// URL to a local path.
+    **/
+    std::filesystem::path file_url_path(const std::string &url);
+}
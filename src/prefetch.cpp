@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstdio>
+#include "prefetch.hpp"
+#include "download.hpp"
+#include "sys.hpp"
+#include "util.hpp"
+
+PrefetchTask::PrefetchTask(const ReleaseInfo &release) :
+    _release(release)
+{
+    _progress = { 0.0f, 0, 0, false };
+    _cancel_requested = false;
+    _is_done = false;
+    _succeeded = false;
+
+    _thread = std::thread(&PrefetchTask::_thread_proc, this);
+}
+
+PrefetchTask::~PrefetchTask()
+{
+    cancel();
+
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void PrefetchTask::_thread_proc()
+{
+    sys::lower_thread_priority();
+    printf("prefetching %s\n", _release.version_name.c_str());
+
+    bool succeeded = false;
+    try
+    {
+        std::filesystem::path path = download::download_release(_release, [&](const download::progress &prog)
+        {
+            std::lock_guard guard(_mutex);
+
+            // the percentage is shown, so only redraw when it changes
+            if ((int)(prog.fraction * 100.0f) != (int)(_progress.fraction * 100.0f))
+                util::wake_main_loop();
+
+            _progress = prog;
+            return !_cancel_requested;
+        });
+
+        succeeded = !path.empty();
+    }
+    catch (std::exception &e)
+    {
+        // not fatal, installing will just download it again
+        fprintf(stderr, "prefetch of %s failed: %s\n", _release.version_name.c_str(), e.what());
+    }
+
+    {
+        std::lock_guard guard(_mutex);
+        _is_done = true;
+        _succeeded = succeeded;
+    }
+
+    _done_cv.notify_all();
+    util::wake_main_loop();
+}
+
+bool PrefetchTask::get_progress(float &out_progress)
+{
+    std::lock_guard guard(_mutex);
+    if (_is_done) return false;
+
+    out_progress = _progress.fraction;
+    return true;
+}
+
+void PrefetchTask::cancel()
+{
+    std::lock_guard guard(_mutex);
+    _cancel_requested = true;
+}
+
+bool PrefetchTask::wait(download::progress_callback_t progress_callback)
+{
+    std::unique_lock lock(_mutex);
+    while (!_is_done)
+    {
+        _done_cv.wait_for(lock, std::chrono::milliseconds(100));
+
+        download::progress progress = _progress;
+        lock.unlock();
+        bool keep_going = progress_callback(progress);
+        lock.lock();
+
+        if (!keep_going)
+            _cancel_requested = true;
+    }
+
+    return _succeeded;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "release.hpp"
+#include "download.hpp"
+
+/**
+* Downloads a release into the cache on a low-priority background thread, so
+* that it is likely already there when the user decides to install it.
+**/
+class PrefetchTask
+{
+private:
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _done_cv;
+
+    const ReleaseInfo _release;
+    download::progress _progress;
+    bool _cancel_requested;
+    bool _is_done;
+    bool _succeeded;
+
+    void _thread_proc();
+
+public:
+    PrefetchTask(const PrefetchTask&) = delete;
+    PrefetchTask& operator=(PrefetchTask const&) = delete;
+    PrefetchTask(const ReleaseInfo &release);
+
+    // cancels the download if it is still running
+    ~PrefetchTask();
+
+    const ReleaseInfo& release() const { return _release; }
+
+    // returns true if still downloading, false if done.
+    bool get_progress(float &out_progress);
+    void cancel();
+
+    /**
+    * Block until the download finishes, forwarding its progress to the callback.
+    * If the callback returns false, the download is canceled.
+    * Returns true if the archive is now in the cache.
+    **/
+    bool wait(download::progress_callback_t progress_callback);
+}; // class PrefetchTask
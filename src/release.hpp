@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+struct ReleaseInfo
+{
+    std::string version_name;
+    std::string api_url;
+    std::string url;
+    std::string changelog;
+    std::string linux_download_url;
+    std::string windows_download_url;
+
+    // size in bytes and digest ("sha256:<hex>") of each asset. these are
+    // zero and empty if the server didn't provide them.
+    uint64_t linux_download_size = 0;
+    uint64_t windows_download_size = 0;
+    std::string linux_download_digest;
+    std::string windows_download_digest;
+};
@@ -0,0 +1,108 @@
+#include <fstream>
+#include "side_by_side.hpp"
+#include "config.hpp"
+
+constexpr const char *VERSIONS_DIR = "versions";
+constexpr const char *CURRENT_LINK = "current";
+constexpr const char *CONFIG_DIR = "config";
+
+// written next to the directory of a version when it is installed, so its
+// modification time is the install time
+constexpr const char *INSTALLED_STAMP_SUFFIX = ".installed";
+
+static std::filesystem::path version_dir(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    return rained_dir / VERSIONS_DIR / std::filesystem::u8path(version_name);
+}
+
+static std::filesystem::path with_suffix(std::filesystem::path path, const char *suffix)
+{
+    path += suffix;
+    return path;
+}
+
+bool side_by_side::enabled()
+{
+    return config::get().side_by_side_installs;
+}
+
+std::filesystem::path side_by_side::active_dir(const std::filesystem::path &rained_dir)
+{
+    std::filesystem::path current = rained_dir / CURRENT_LINK;
+
+    std::error_code ec;
+    if (enabled() && std::filesystem::is_directory(current, ec))
+        return current;
+
+    return rained_dir;
+}
+
+bool side_by_side::is_installed(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    std::error_code ec;
+    return std::filesystem::is_directory(version_dir(rained_dir, version_name), ec);
+}
+
+bool side_by_side::is_shared(const std::filesystem::path &entry_path)
+{
+    return entry_path.u8string().substr(0, 7) == "config/";
+}
+
+std::filesystem::path side_by_side::begin_install(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    // versions are installed under another name, and only renamed once they are
+    // complete, so is_installed never sees half of one
+    std::filesystem::path dir = with_suffix(version_dir(rained_dir, version_name), ".partial");
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir;
+}
+
+void side_by_side::finish_install(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    std::filesystem::path dir = version_dir(rained_dir, version_name);
+    std::filesystem::path partial_dir = with_suffix(dir, ".partial");
+    std::filesystem::path old_dir = with_suffix(dir, ".old");
+
+    // relative, so the installation can be moved
+    std::filesystem::create_directories(rained_dir / CONFIG_DIR);
+    std::filesystem::create_directory_symlink(std::filesystem::path("..") / ".." / CONFIG_DIR, partial_dir / CONFIG_DIR);
+
+    // a version installed again, like a newer nightly, replaces the old
+    // directory. remove_all doesn't follow the config link.
+    std::error_code ec;
+    std::filesystem::remove_all(old_dir, ec);
+    if (std::filesystem::exists(std::filesystem::symlink_status(dir)))
+        std::filesystem::rename(dir, old_dir);
+
+    std::filesystem::rename(partial_dir, dir);
+    std::filesystem::remove_all(old_dir, ec);
+
+    // the stamp is kept outside the version directory, which belongs to rained
+    std::ofstream(with_suffix(dir, INSTALLED_STAMP_SUFFIX));
+}
+
+std::filesystem::file_time_type side_by_side::installed_time(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    std::error_code ec;
+    auto time = std::filesystem::last_write_time(with_suffix(version_dir(rained_dir, version_name), INSTALLED_STAMP_SUFFIX), ec);
+    return ec ? std::filesystem::file_time_type::min() : time;
+}
+
+void side_by_side::activate(const std::filesystem::path &rained_dir, const std::string &version_name)
+{
+    std::filesystem::path link = rained_dir / CURRENT_LINK;
+    std::filesystem::path tmp_link = with_suffix(link, ".tmp");
+
+    std::error_code ec;
+    std::filesystem::remove(tmp_link, ec);
+    std::filesystem::create_directory_symlink(std::filesystem::path(VERSIONS_DIR) / std::filesystem::u8path(version_name), tmp_link);
+
+#ifdef _WIN32
+    // windows can't rename over a directory link, so there is a moment without one
+    std::filesystem::remove(link, ec);
+#endif
+
+    // renaming over the old link swaps it in one step
+    std::filesystem::rename(tmp_link, link);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+/**
+* Side-by-side installs, enabled with the side_by_side_installs setting. Every
+* installed version is kept in its own directory, rained_dir/versions/<version>,
+* and rained_dir/current is a symbolic link to the active one, which is
+* replaced atomically to switch versions. The files come from the store, so on
+* filesystems with reflinks an extra version costs little more than its
+* directory entries.
+*
+* Rained keeps its settings in the config directory next to its executable.
+* The config directory of every version is a link to rained_dir/config, so
+* settings carry over between versions.
+**/
+namespace side_by_side
+{
+    bool enabled();
+
+    /**
+    * Get the directory of the active installation: rained_dir/current if
+    * side-by-side installs are enabled and one was made, otherwise rained_dir.
+    **/
+    std::filesystem::path active_dir(const std::filesystem::path &rained_dir);
+
+    /**
+    * Returns true if the version was completely installed side by side.
+    **/
+    bool is_installed(const std::filesystem::path &rained_dir, const std::string &version_name);
+
+    /**
+    * Returns true for entries of a release that go to the shared config
+    * directory instead of the directory of the version.
+    **/
+    bool is_shared(const std::filesystem::path &entry_path);
+
+    /**
+    * Create an empty directory to install a version into, and return it.
+    **/
+    std::filesystem::path begin_install(const std::filesystem::path &rained_dir, const std::string &version_name);
+
+    /**
+    * Move the directory made by begin_install into place, replacing an earlier
+    * install of the same version.
+    **/
+    void finish_install(const std::filesystem::path &rained_dir, const std::string &version_name);
+
+    /**
+    * Get when the files of an installed version were put in place by
+    * finish_install, or the minimum time if that isn't known.
+    **/
+    std::filesystem::file_time_type installed_time(const std::filesystem::path &rained_dir, const std::string &version_name);
+
+    /**
+    * Point rained_dir/current at an installed version.
+    **/
+    void activate(const std::filesystem::path &rained_dir, const std::string &version_name);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace util
+{
+    /**
+    * Fixed-capacity lock-free queue for handing data from exactly one producer
+    * thread to exactly one consumer thread. Neither side ever blocks or
+    * allocates; try_push() fails while the queue is full and try_pop() fails
+    * while it is empty. Slots are reused, so items that keep their storage
+    * when moved from (like strings) stop allocating once warmed up.
+    **/
+    template <typename T, size_t Capacity>
+    class spsc_queue
+    {
+        static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "spsc_queue capacity must be a power of two");
+
+    private:
+        // each index is written by one side only. they are kept on separate
+        // cache lines so the two threads don't keep stealing the line from
+        // each other.
+        alignas(64) std::atomic<size_t> _head; // next slot to read
+        alignas(64) std::atomic<size_t> _tail; // next slot to write
+        T _slots[Capacity];
+
+    public:
+        spsc_queue(const spsc_queue&) = delete;
+        spsc_queue& operator=(spsc_queue const&) = delete;
+
+        spsc_queue() : _head(0), _tail(0)
+        {}
+
+        /**
+        * Producer only. Returns false if the queue is full, in which case the
+        * item is left untouched.
+        **/
+        bool try_push(T &&item)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == Capacity)
+                return false;
+
+            _slots[tail % Capacity] = std::move(item);
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+        * Consumer only. Returns false if the queue is empty.
+        **/
+        bool try_pop(T &out_item)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+                return false;
+
+            std::swap(out_item, _slots[head % Capacity]);
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+    }; // class spsc_queue
+} // namespace util
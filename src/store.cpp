@@ -0,0 +1,393 @@
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <unordered_set>
+#include "store.hpp"
+#include "archive.hpp"
+#include "delta.hpp"
+#include "download.hpp"
+#include "sys.hpp"
+#include "tasks.hpp"
+#include "json.hpp"
+
+using namespace nlohmann;
+
+static std::filesystem::path store_path()
+{
+    return download::rainedvm_path() / "store";
+}
+
+static std::filesystem::path version_path(const std::string &version_name)
+{
+    return store_path() / "versions" / std::filesystem::u8path(version_name + ".json");
+}
+
+// objects are spread over 256 directories so that none of them gets huge.
+// the size is part of the name so that a hash collision would also need
+// files of the same size, and the executable bit because hard links share it.
+static std::filesystem::path object_path(const store::file_entry &entry)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "%016" PRIx64 "-%" PRIu64 "%s", entry.hash, entry.size, entry.executable ? "x" : "");
+    return store_path() / "objects" / std::string(name, 2) / name;
+}
+
+static json files_to_json(const std::vector<store::file_entry> &files)
+{
+    json file_list = json::array();
+    for (auto &entry : files)
+    {
+        json file = {
+            { "path", entry.path.u8string() },
+            { "size", entry.size },
+            { "hash", entry.hash },
+            { "exec", entry.executable }
+        };
+
+        if (!entry.link_target.empty())
+            file["link"] = entry.link_target;
+
+        file_list.push_back(std::move(file));
+    }
+
+    return file_list;
+}
+
+static std::vector<store::file_entry> files_from_json(const json &file_list)
+{
+    std::vector<store::file_entry> files;
+    for (auto &file : file_list)
+    {
+        files.push_back({
+            std::filesystem::u8path(file.at("path").get<std::string>()),
+            file.at("size").get<uint64_t>(),
+            file.at("hash").get<uint64_t>(),
+            file.at("exec").get<bool>(),
+            file.value("link", std::string())
+        });
+    }
+
+    return files;
+}
+
+static bool has_objects(const std::vector<store::file_entry> &files)
+{
+    for (auto &entry : files)
+    {
+        if (entry.link_target.empty() && !std::filesystem::exists(object_path(entry)))
+            return false;
+    }
+
+    return true;
+}
+
+// hard linked files share their contents with the store, so anything the
+// user may edit gets a copy of its own. that leaves the program and its
+// libraries, which are read-only in the store.
+static bool is_linkable(const store::file_entry &entry)
+{
+#ifdef _WIN32
+    // objects aren't read-only on windows, so an edit through a hard link
+    // would change them for every version
+    (void)entry;
+    return false;
+#else
+    if (entry.path.u8string().substr(0, 7) == "config/")
+        return false;
+
+    std::string ext = entry.path.extension().u8string();
+    return entry.executable || ext == ".so" || ext == ".dll";
+#endif
+}
+
+static store::file_entry import_file(const std::filesystem::path &src_path, const std::filesystem::path &entry_path, size_t index)
+{
+    store::file_entry entry { entry_path, 0, 0, false, {} };
+
+    std::filesystem::file_status status = std::filesystem::symlink_status(src_path);
+    if (std::filesystem::is_symlink(status))
+    {
+        entry.link_target = std::filesystem::read_symlink(src_path).u8string();
+        return entry;
+    }
+
+    entry.size = std::filesystem::file_size(src_path);
+    if (!delta::hash_file(src_path, entry.hash))
+        throw std::runtime_error("could not read " + src_path.u8string());
+
+#ifndef _WIN32
+    entry.executable = (status.permissions() & std::filesystem::perms::owner_exec) != std::filesystem::perms::none;
+#endif
+
+    std::filesystem::path obj_path = object_path(entry);
+    if (std::filesystem::exists(obj_path))
+        return entry;
+
+    // another task may be creating the same directory
+    std::error_code ec;
+    std::filesystem::create_directories(obj_path.parent_path(), ec);
+
+    // rename fails if the store is on another filesystem. the copy gets a name
+    // of its own, since another task may be importing the same contents.
+    std::filesystem::rename(src_path, obj_path, ec);
+    if (ec)
+    {
+        std::filesystem::path tmp_path = obj_path;
+        tmp_path += "." + std::to_string(index) + ".tmp";
+        std::filesystem::copy_file(src_path, tmp_path, std::filesystem::copy_options::overwrite_existing);
+        std::filesystem::rename(tmp_path, obj_path);
+    }
+
+#ifndef _WIN32
+    // not on windows, which can't delete read-only files. the hard links of
+    // an installed version would be read-only too.
+    std::filesystem::permissions(obj_path,
+        std::filesystem::perms::owner_write | std::filesystem::perms::group_write | std::filesystem::perms::others_write,
+        std::filesystem::perm_options::remove, ec);
+#endif
+
+    return entry;
+}
+
+std::vector<store::file_entry> store::import_files(const std::filesystem::path &dir, const std::vector<std::filesystem::path> &files)
+{
+    std::vector<std::future<file_entry>> entries;
+    for (auto &path : files)
+    {
+        std::filesystem::path src_path = dir / path;
+        if (std::filesystem::is_directory(std::filesystem::symlink_status(src_path)))
+            continue;
+
+        entries.push_back(tasks::shared().submit([src_path, path, index = entries.size()]()
+        {
+            return import_file(src_path, path, index);
+        }));
+    }
+
+    // let every task finish before one of them throws out of here
+    for (auto &entry : entries)
+        tasks::shared().wait(entry);
+
+    std::vector<file_entry> result;
+    for (auto &entry : entries)
+        result.push_back(entry.get());
+
+    return result;
+}
+
+void store::save_version(const std::string &version_name, const std::filesystem::path &archive_path, const std::vector<file_entry> &files)
+{
+    json data;
+    data["archive"] = archive::archive_key(archive_path);
+    data["files"] = files_to_json(files);
+
+    std::filesystem::path path = version_path(version_name);
+    std::filesystem::create_directories(path.parent_path());
+
+    std::ofstream stream(path);
+    stream << data.dump();
+}
+
+bool store::load_version(const std::string &version_name, const std::filesystem::path &archive_path, std::vector<file_entry> &out_files)
+{
+    std::ifstream stream(version_path(version_name));
+    if (!stream.is_open())
+        return false;
+
+    std::vector<file_entry> files;
+    try
+    {
+        json data = json::parse(stream);
+        if (!archive_path.empty() && data.at("archive") != archive::archive_key(archive_path))
+            return false;
+
+        files = files_from_json(data.at("files"));
+    }
+    catch (json::exception &e)
+    {
+        fprintf(stderr, "could not read index of %s: %s\n", version_name.c_str(), e.what());
+        return false;
+    }
+
+    if (!has_objects(files))
+        return false;
+
+    out_files = std::move(files);
+    return true;
+}
+
+static bool load_installation(const std::filesystem::path &path, store::installation &out_installation)
+{
+    std::ifstream stream(path);
+    if (!stream.is_open())
+        return false;
+
+    try
+    {
+        json data = json::parse(stream);
+        out_installation.version_name = data.at("version").get<std::string>();
+        out_installation.files = files_from_json(data.at("files"));
+
+        // records from before install times were kept have none
+        auto min_ticks = std::filesystem::file_time_type::min().time_since_epoch().count();
+        auto ticks = data.value("installed", min_ticks);
+        out_installation.installed_time = std::filesystem::file_time_type(std::filesystem::file_time_type::duration(ticks));
+    }
+    catch (json::exception &e)
+    {
+        fprintf(stderr, "could not read %s: %s\n", path.filename().u8string().c_str(), e.what());
+        return false;
+    }
+
+    return true;
+}
+
+static bool has_same_files(const std::vector<store::file_entry> &a, const std::vector<store::file_entry> &b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i].path != b[i].path || a[i].hash != b[i].hash || a[i].size != b[i].size || a[i].link_target != b[i].link_target)
+            return false;
+    }
+
+    return true;
+}
+
+void store::record_installed(const std::string &version_name, const std::vector<file_entry> &files, std::filesystem::file_time_type installed_time)
+{
+    std::filesystem::path current_path = store_path() / "current.json";
+
+    // reinstalling the same files, like a sync, shouldn't lose the previous
+    // installation. a newer nightly has the same name but other files.
+    installation current;
+    if (load_installation(current_path, current) && !(current.version_name == version_name && has_same_files(current.files, files)))
+        std::filesystem::rename(current_path, store_path() / "previous.json");
+
+    json data;
+    data["version"] = version_name;
+    data["installed"] = installed_time.time_since_epoch().count();
+    data["files"] = files_to_json(files);
+
+    std::filesystem::create_directories(store_path());
+    std::ofstream stream(current_path);
+    stream << data.dump();
+}
+
+bool store::load_installed(installation &out_installation)
+{
+    return load_installation(store_path() / "current.json", out_installation);
+}
+
+bool store::load_previous(installation &out_installation)
+{
+    return load_installation(store_path() / "previous.json", out_installation) && has_objects(out_installation.files);
+}
+
+void store::remove_version(const std::string &version_name)
+{
+    std::error_code ec;
+    std::filesystem::remove(version_path(version_name), ec);
+}
+
+static void add_object_names(const std::vector<store::file_entry> &files, std::unordered_set<std::string> &names)
+{
+    for (auto &entry : files)
+    {
+        if (entry.link_target.empty())
+            names.insert(object_path(entry).filename().u8string());
+    }
+}
+
+uint64_t store::collect_garbage()
+{
+    std::unordered_set<std::string> referenced;
+
+    std::error_code ec;
+    for (auto &dir_entry : std::filesystem::directory_iterator(store_path() / "versions", ec))
+    {
+        std::ifstream stream(dir_entry.path());
+        try
+        {
+            add_object_names(files_from_json(json::parse(stream).at("files")), referenced);
+        }
+        catch (json::exception &e)
+        {
+            // an index that can't be read can't be used either
+            fprintf(stderr, "could not read %s: %s\n", dir_entry.path().filename().u8string().c_str(), e.what());
+        }
+    }
+
+    installation record;
+    if (load_installed(record))
+        add_object_names(record.files, referenced);
+    if (load_installation(store_path() / "previous.json", record))
+        add_object_names(record.files, referenced);
+
+    // this also sweeps up the temporary files of an import that was interrupted
+    uint64_t freed = 0;
+    std::vector<std::filesystem::path> unreferenced;
+    for (auto &dir_entry : std::filesystem::recursive_directory_iterator(store_path() / "objects", ec))
+    {
+        if (dir_entry.is_regular_file(ec) && referenced.count(dir_entry.path().filename().u8string()) == 0)
+        {
+            freed += dir_entry.file_size(ec);
+            unreferenced.push_back(dir_entry.path());
+        }
+    }
+
+    for (auto &path : unreferenced)
+        std::filesystem::remove(path, ec);
+
+    printf("store: removed %zu unused files\n", unreferenced.size());
+    return freed;
+}
+
+bool store::matches(const file_entry &entry, const std::filesystem::path &path)
+{
+    std::error_code ec;
+    if (!entry.link_target.empty())
+        return std::filesystem::read_symlink(path, ec).u8string() == entry.link_target && !ec;
+
+    uint64_t hash;
+    return std::filesystem::file_size(path, ec) == entry.size && !ec &&
+        delta::hash_file(path, hash) && hash == entry.hash;
+}
+
+store::link_method store::materialize(const file_entry &entry, const std::filesystem::path &dest)
+{
+    // a hard link or a reflink can't be made over an existing file
+    std::error_code ec;
+    std::filesystem::remove(dest, ec);
+    if (dest.has_parent_path())
+        std::filesystem::create_directories(dest.parent_path());
+
+    if (!entry.link_target.empty())
+    {
+        std::filesystem::create_symlink(std::filesystem::u8path(entry.link_target), dest);
+        return link_method::symlink;
+    }
+
+    std::filesystem::path obj_path = object_path(entry);
+    if (sys::clone_file(obj_path, dest))
+        return link_method::reflink;
+
+    if (is_linkable(entry))
+    {
+        std::filesystem::create_hard_link(obj_path, dest, ec);
+        if (!ec)
+            return link_method::hardlink;
+    }
+
+    std::filesystem::copy_file(obj_path, dest);
+
+#ifndef _WIN32
+    std::filesystem::permissions(dest, std::filesystem::perms::owner_write, std::filesystem::perm_options::add);
+#endif
+
+    return link_method::copy;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+* Content-addressed store for the files of installed versions, in .rainedvm/store.
+* Every file is kept once under objects/, named after its hash, size and whether
+* it is executable, so the assets that most versions share take up space only once.
+* versions/ holds an index of the files of each version that was installed, and
+* current.json and previous.json the files of the installation and the one it
+* replaced, which can be restored without the archive.
+*
+* Installing puts files in place as reflinks where the filesystem supports them,
+* otherwise as copies. Users edit the assets and settings of an installation, so
+* only binaries are hard linked, and only on POSIX systems, where objects are made
+* read-only so that writing to a hard-linked file fails instead of silently
+* changing it for every version. Windows can't keep objects read-only, so
+* nothing is hard linked there.
+**/
+namespace store
+{
+    struct file_entry
+    {
+        // relative to the installation
+        std::filesystem::path path;
+
+        uint64_t size;
+        uint64_t hash;
+        bool executable;
+
+        // if not empty, the entry is a symbolic link to this and has no object
+        std::string link_target;
+    };
+
+    /**
+    * The files of an installation, and the version they belong to.
+    **/
+    struct installation
+    {
+        std::string version_name;
+        std::vector<file_entry> files;
+
+        // when the files were put in place. a file written later was changed
+        // by something other than the install. the minimum if not known.
+        std::filesystem::file_time_type installed_time = std::filesystem::file_time_type::min();
+    };
+
+    enum class link_method
+    {
+        reflink,
+        hardlink,
+        copy,
+        symlink
+    };
+
+    /**
+    * Move the given files of dir into the store, hashing them on the task pool.
+    * Files whose contents are already in the store are left where they are.
+    * Directories are skipped. Returns the entries of the imported files.
+    **/
+    std::vector<file_entry> import_files(const std::filesystem::path &dir, const std::vector<std::filesystem::path> &files);
+
+    /**
+    * Record the files of a version, as extracted from the given release archive.
+    **/
+    void save_version(const std::string &version_name, const std::filesystem::path &archive_path, const std::vector<file_entry> &files);
+
+    /**
+    * Load the index of a version. Returns false if there is none, if it was made
+    * from a different archive than the given one, or if any of its objects is gone.
+    * An empty archive_path accepts the index whichever archive it was made from.
+    **/
+    bool load_version(const std::string &version_name, const std::filesystem::path &archive_path, std::vector<file_entry> &out_files);
+
+    /**
+    * Forget the index of a version. Its objects stay until collect_garbage.
+    **/
+    void remove_version(const std::string &version_name);
+
+    /**
+    * Delete the objects that no version index or installation record refers
+    * to. Returns the number of bytes freed.
+    **/
+    uint64_t collect_garbage();
+
+    /**
+    * Record the files of a version that was just installed, and when they were
+    * put in place. The installation it replaces is kept as the previous one,
+    * unless it had the same files.
+    **/
+    void record_installed(const std::string &version_name, const std::vector<file_entry> &files, std::filesystem::file_time_type installed_time);
+
+    /**
+    * Load the record of the current installation. Returns false if there is none.
+    **/
+    bool load_installed(installation &out_installation);
+
+    /**
+    * Load the record of the installation before the current one. Returns false
+    * if there is none, or if any of its objects is gone.
+    **/
+    bool load_previous(installation &out_installation);
+
+    /**
+    * Returns true if the file at path has the contents of the entry. Only the
+    * size is read for most files that differ.
+    **/
+    bool matches(const file_entry &entry, const std::filesystem::path &path);
+
+    /**
+    * Create dest from the stored contents of the entry, replacing what is there.
+    * Throws if the object is missing or can't be copied.
+    **/
+    link_method materialize(const file_entry &entry, const std::filesystem::path &dest);
+}
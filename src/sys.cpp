@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <stdexcept>
 #include <system_error>
+#include <thread>
 #include <stdio.h>
 #include "sys.hpp"
 #include "sys_args_internal.hpp"
@@ -8,162 +14,325 @@
 #else
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+extern char **environ;
 #endif
 
-int sys::subprocess(const std::string &cmdline, std::ostream &stdout_stream)
-{
 #ifdef _WIN32
-    STARTUPINFO si;
-    ZeroMemory(&si, sizeof(si));
-    PROCESS_INFORMATION pi;
-    ZeroMemory(&pi, sizeof(pi));
+// quote an argument so that CommandLineToArgvW splits it back out unchanged
+static void append_quoted(std::wstring &cmdline, const std::wstring &arg)
+{
+    if (!arg.empty() && arg.find_first_of(L" \t\n\v\"") == std::wstring::npos)
+    {
+        cmdline += arg;
+        return;
+    }
 
-    HANDLE cout_r = NULL;
-    HANDLE cout_w = NULL;
-    SECURITY_ATTRIBUTES sa;
-    ZeroMemory(&sa, sizeof(sa));
+    cmdline += L'"';
+    for (auto it = arg.begin(); ; it++)
+    {
+        size_t backslashes = 0;
+        while (it != arg.end() && *it == L'\\')
+        {
+            it++;
+            backslashes++;
+        }
 
-    sa.nLength = sizeof(SECURITY_ATTRIBUTES);
-    sa.lpSecurityDescriptor = NULL;
-    sa.bInheritHandle = true;
+        // backslashes are only special before a quote
+        if (it == arg.end())
+        {
+            cmdline.append(backslashes * 2, L'\\');
+            break;
+        }
+        else if (*it == L'"')
+        {
+            cmdline.append(backslashes * 2 + 1, L'\\');
+            cmdline += *it;
+        }
+        else
+        {
+            cmdline.append(backslashes, L'\\');
+            cmdline += *it;
+        }
+    }
+    cmdline += L'"';
+}
 
-    if (!CreatePipe(&cout_r, &cout_w, &sa, 0))
-        THROW_WIN32_ERROR();
+int sys::spawn(const std::vector<std::string> &argv, const spawn_options &options)
+{
+    if (argv.empty())
+        throw std::invalid_argument("sys::spawn: argv is empty");
 
-    if (!SetHandleInformation(cout_r, HANDLE_FLAG_INHERIT, 0))
-        THROW_WIN32_ERROR();
-    
-    si.cb = sizeof(STARTUPINFO);
+    std::wstring cmdline;
+    for (size_t i = 0; i < argv.size(); i++)
+    {
+        if (i > 0) cmdline += L' ';
+        append_quoted(cmdline, std::filesystem::u8path(argv[i]).wstring());
+    }
+
+    HANDLE out_r = NULL;
+    HANDLE out_w = NULL;
+
+    if (options.on_output)
+    {
+        SECURITY_ATTRIBUTES sa;
+        ZeroMemory(&sa, sizeof(sa));
+        sa.nLength = sizeof(SECURITY_ATTRIBUTES);
+        sa.bInheritHandle = true;
+
+        if (!CreatePipe(&out_r, &out_w, &sa, 0))
+            THROW_WIN32_ERROR();
+
+        // only the write end goes to the child
+        if (!SetHandleInformation(out_r, HANDLE_FLAG_INHERIT, 0))
+        {
+            CloseHandle(out_r);
+            CloseHandle(out_w);
+            THROW_WIN32_ERROR();
+        }
+    }
+
+    STARTUPINFOW si;
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
     si.dwFlags |= STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
     si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
-    si.hStdOutput = cout_w;
-    si.hStdError = cout_w;
+    si.hStdOutput = out_w ? out_w : GetStdHandle(STD_OUTPUT_HANDLE);
+    si.hStdError = (out_w && options.merge_stderr) ? out_w : GetStdHandle(STD_ERROR_HANDLE);
     si.wShowWindow = SW_HIDE;
 
-    //si.dwFlags = STARTF_USESHOWWINDOW;
-    //si.wShowWindow = SW_HIDE;
-
-    char cmd[256];
-    strcpy_s(cmd, 256, cmdline.c_str());
+    PROCESS_INFORMATION pi;
+    ZeroMemory(&pi, sizeof(pi));
 
-    BOOL success = CreateProcess(
-        NULL,
-        cmd,
-        NULL,
-        NULL,
-        TRUE,
-        0,
-        NULL,
-        NULL,
-        &si,
-        &pi
-    );
+    BOOL success = CreateProcessW(NULL, cmdline.data(), NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi);
+    if (out_w)
+        CloseHandle(out_w);
 
-    if (success)
+    if (!success)
     {
-        CloseHandle(pi.hThread);
-        CloseHandle(cout_w);
+        DWORD err = GetLastError();
+        if (out_r) CloseHandle(out_r);
+        throw std::system_error(std::error_code(err, std::system_category()), "could not run " + argv[0]);
     }
-    else
+    CloseHandle(pi.hThread);
+
+    // pipes can't be waited on with a timeout, so they're read on another thread
+    std::exception_ptr callback_error;
+    std::thread reader;
+    if (out_r)
     {
-        THROW_WIN32_ERROR();
+        reader = std::thread([&]()
+        {
+            char buf[16384];
+            DWORD count;
+            while (ReadFile(out_r, buf, sizeof(buf), &count, NULL) && count > 0)
+            {
+                try
+                {
+                    options.on_output(buf, count);
+                }
+                catch (...)
+                {
+                    callback_error = std::current_exception();
+                    break;
+                }
+            }
+        });
     }
-    
-    CHAR buf[128];
-    ZeroMemory(buf, sizeof(buf));
-    DWORD dwRead;
 
-    while (ReadFile(cout_r, buf, sizeof(buf)-1, &dwRead, NULL))
-        stdout_stream.write(buf, dwRead);
+    DWORD wait = WaitForSingleObject(pi.hProcess, options.timeout_ms > 0 ? (DWORD)options.timeout_ms : INFINITE);
+    bool timed_out = wait == WAIT_TIMEOUT;
+    if (timed_out || callback_error)
+        TerminateProcess(pi.hProcess, 1);
 
-    if (GetLastError() != ERROR_BROKEN_PIPE)
-        THROW_WIN32_ERROR();
-    
-    CloseHandle(cout_r);
+    if (reader.joinable())
+    {
+        // a grandchild may still hold the pipe open
+        if (timed_out) CancelSynchronousIo(reader.native_handle());
+        reader.join();
+        CloseHandle(out_r);
+    }
 
-    WaitForSingleObject(pi.hProcess, INFINITE);
+    if (callback_error)
+    {
+        CloseHandle(pi.hProcess);
+        std::rethrow_exception(callback_error);
+    }
 
-    DWORD exitCode;
-    GetExitCodeProcess(pi.hProcess, &exitCode);
+    if (timed_out)
+    {
+        CloseHandle(pi.hProcess);
+        throw std::runtime_error("ERROR: " + argv[0] + " timed out");
+    }
+
+    DWORD exit_code;
+    GetExitCodeProcess(pi.hProcess, &exit_code);
     CloseHandle(pi.hProcess);
-    
-    return (int)exitCode;
-#else
-    char buf[1024];
 
-    auto pipe = popen(cmdline.c_str(), "r");
-    if (!pipe)
+    return (int)exit_code;
+}
+#else
+// milliseconds left until the deadline, or -1 if there is none
+static int remaining_ms(const std::optional<std::chrono::steady_clock::time_point> &deadline)
+{
+    if (!deadline)
         return -1;
-    
-    size_t count;
-    while (!feof(pipe))
+
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now()).count();
+    return left > 0 ? (int)left : 0;
+}
+
+static int wait_child(pid_t pid)
+{
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0)
     {
-        if ((count = fread(buf, 1, sizeof(buf), pipe)) > 0)
-            stdout_stream.write(buf, count);
+        if (errno != EINTR)
+            return -1;
     }
 
-    return pclose(pipe);
-#endif
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
 }
 
-int sys::subprocess(const std::string &cmdline)
+int sys::spawn(const std::vector<std::string> &argv, const spawn_options &options)
 {
-#ifdef _WIN32
-    STARTUPINFO si;
-    ZeroMemory(&si, sizeof(si));
-    PROCESS_INFORMATION pi;
-    ZeroMemory(&pi, sizeof(pi));
-    
-    si.cb = sizeof(STARTUPINFO);
-    si.dwFlags |= STARTF_USESTDHANDLES | STARTF_USESHOWWINDOW;
-    si.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
-    si.hStdOutput = GetStdHandle(STD_OUTPUT_HANDLE);
-    si.hStdError = GetStdHandle(STD_ERROR_HANDLE);
-    si.wShowWindow = SW_HIDE;
+    if (argv.empty())
+        throw std::invalid_argument("sys::spawn: argv is empty");
 
-    //si.dwFlags = STARTF_USESHOWWINDOW;
-    //si.wShowWindow = SW_HIDE;
+    std::vector<char*> args;
+    for (const std::string &arg : argv)
+        args.push_back(const_cast<char*>(arg.c_str()));
+    args.push_back(nullptr);
 
-    char cmd[256];
-    strcpy_s(cmd, 256, cmdline.c_str());
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (options.timeout_ms > 0)
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(options.timeout_ms);
 
-    BOOL success = CreateProcess(
-        NULL,
-        cmd,
-        NULL,
-        NULL,
-        TRUE,
-        0,
-        NULL,
-        NULL,
-        &si,
-        &pi
-    );
+    // both ends are close-on-exec, the child only keeps the dup2'd copy
+    int out_pipe[2] = { -1, -1 };
+    if (options.on_output && pipe2(out_pipe, O_CLOEXEC) != 0)
+        throw std::system_error(errno, std::generic_category(), "could not create pipe");
 
-    if (success)
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    if (out_pipe[1] >= 0)
     {
-        CloseHandle(pi.hThread);
+        posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+        if (options.merge_stderr)
+            posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
     }
-    else
+
+    // posix_spawn doesn't copy the parent's page tables like fork does, so
+    // this stays cheap however much memory the app has mapped
+    pid_t pid;
+    int err = posix_spawnp(&pid, args[0], &actions, nullptr, args.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (out_pipe[1] >= 0)
+        close(out_pipe[1]);
+
+    if (err != 0)
     {
-        THROW_WIN32_ERROR();
+        if (out_pipe[0] >= 0) close(out_pipe[0]);
+        throw std::system_error(err, std::generic_category(), "could not run " + argv[0]);
     }
 
-    WaitForSingleObject(pi.hProcess, INFINITE);
+    bool timed_out = false;
 
-    DWORD exitCode;
-    GetExitCodeProcess(pi.hProcess, &exitCode);
-    CloseHandle(pi.hProcess);
-    
-    return (int)exitCode;
-#else
-    auto pipe = popen(cmdline.c_str(), "r");
-    if (!pipe)
-        return false;
+    if (out_pipe[0] >= 0)
+    {
+        char buf[16384];
+        try
+        {
+            while (true)
+            {
+                pollfd pfd { out_pipe[0], POLLIN, 0 };
+                int ready = poll(&pfd, 1, remaining_ms(deadline));
+                if (ready < 0)
+                {
+                    if (errno == EINTR) continue;
+                    break;
+                }
 
-    return pclose(pipe);
-#endif
+                if (ready == 0)
+                {
+                    timed_out = true;
+                    break;
+                }
+
+                ssize_t count = read(out_pipe[0], buf, sizeof(buf));
+                if (count < 0)
+                {
+                    if (errno == EINTR) continue;
+                    break;
+                }
+
+                // end of file
+                if (count == 0)
+                    break;
+
+                options.on_output(buf, (size_t)count);
+            }
+        }
+        catch (...)
+        {
+            close(out_pipe[0]);
+            kill(pid, SIGKILL);
+            wait_child(pid);
+            throw;
+        }
+
+        close(out_pipe[0]);
+    }
+
+    // the output was closed, or there was none. wait for the exit.
+    if (!timed_out && deadline)
+    {
+        while (true)
+        {
+            int status;
+            pid_t res = waitpid(pid, &status, WNOHANG);
+            if (res == pid)
+                return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+            if (res < 0 && errno != EINTR)
+                return -1;
+
+            int left = remaining_ms(deadline);
+            if (left == 0)
+            {
+                timed_out = true;
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min(left, 10)));
+        }
+    }
+
+    if (timed_out)
+    {
+        kill(pid, SIGKILL);
+        wait_child(pid);
+        throw std::runtime_error("ERROR: " + argv[0] + " timed out");
+    }
+
+    return wait_child(pid);
 }
+#endif
 
 bool sys::open_url(const std::string &url)
 {
@@ -176,26 +345,261 @@ bool sys::open_url(const std::string &url)
         return false;
     }
 #else
+    std::string arg0 = "xdg-open";
+    std::string arg1 = url;
+    char *args[3] = { arg0.data(), arg1.data(), nullptr };
+
     pid_t pid;
+    int err = posix_spawnp(&pid, args[0], nullptr, nullptr, args, environ);
+    if (err != 0)
+    {
+        fprintf(stderr, "could not run xdg-open: %s\n", std::generic_category().message(err).c_str());
+        return false;
+    }
+
+    // without a desktop environment, xdg-open runs the browser itself and
+    // only exits with it, so it is reaped in the background rather than
+    // waited for here or left behind as a zombie
+    std::thread([pid]() { wait_child(pid); }).detach();
 
-    if ((pid = fork()) < 0)
+    return true;
+#endif
+}
+
+void sys::lower_thread_priority()
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+    // on linux, the nice value is per-thread
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 10);
+#endif
+}
+
+bool sys::file_index(const std::filesystem::path &path, uint64_t &out_index)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    BY_HANDLE_FILE_INFORMATION info;
+    BOOL success = GetFileInformationByHandle(file, &info);
+    CloseHandle(file);
+    if (!success)
+        return false;
+
+    uint64_t index = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    out_index = index ^ ((uint64_t)info.dwVolumeSerialNumber << 48);
+    return true;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    out_index = (uint64_t)st.st_ino ^ ((uint64_t)st.st_dev << 48);
+    return true;
+#endif
+}
+
+bool sys::clone_file(const std::filesystem::path &src, const std::filesystem::path &dest)
+{
+#if defined(__linux__) && defined(FICLONE)
+    int src_fd = open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (src_fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(src_fd, &st) != 0)
+    {
+        close(src_fd);
+        return false;
+    }
+
+    // the clone is a file of its own, so it can always be written
+    int dest_fd = open(dest.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, (st.st_mode & 0777) | S_IWUSR);
+    if (dest_fd < 0)
+    {
+        close(src_fd);
+        return false;
+    }
+
+    bool success = ioctl(dest_fd, FICLONE, src_fd) == 0;
+    close(dest_fd);
+    close(src_fd);
+
+    if (!success)
+        unlink(dest.c_str());
+
+    return success;
+#else
+    // ReFS can clone blocks too, but rainedvm is hardly ever installed on it
+    (void) src;
+    (void) dest;
+    return false;
+#endif
+}
+
+sys::mapped_file::~mapped_file()
+{
+    close();
+}
+
+bool sys::mapped_file::open(const std::filesystem::path &path)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping == NULL)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == NULL)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    _file = file;
+    _mapping = mapping;
+    _data = (const uint8_t*) data;
+    _size = (size_t) size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
     {
-        fprintf(stderr, "fork failed");
+        ::close(fd);
         return false;
     }
-    
-    if (pid == 0)
+
+    // the mapping stays valid after the descriptor is closed
+    void *data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    _data = (const uint8_t*) data;
+    _size = (size_t) st.st_size;
+#endif
+
+    return true;
+}
+
+void sys::mapped_file::close()
+{
+    if (_data == nullptr)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(_mapping);
+    CloseHandle(_file);
+    _file = nullptr;
+    _mapping = nullptr;
+#else
+    munmap((void*) _data, _size);
+#endif
+
+    _data = nullptr;
+    _size = 0;
+}
+
+sys::file_lock::~file_lock()
+{
+    unlock();
+}
+
+bool sys::file_lock::acquire(const std::filesystem::path &path, bool wait)
+{
+    unlock();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("could not open " + path.u8string());
+
+    DWORD flags = LOCKFILE_EXCLUSIVE_LOCK;
+    if (!wait)
+        flags |= LOCKFILE_FAIL_IMMEDIATELY;
+
+    OVERLAPPED overlapped = {};
+    if (!LockFileEx(file, flags, 0, 1, 0, &overlapped))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    _file = file;
+#else
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0)
+        throw std::runtime_error("could not open " + path.u8string());
+
+    int result;
+    do
     {
-        // child process
-        std::string arg0 = "xdg-open";
-        std::string arg1 = url;
+        result = flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB);
+    } while (result != 0 && errno == EINTR);
 
-        char *args[3] = { arg0.data(), arg1.data(), nullptr };
-        execvp(args[0], args);
-        exit(0);
+    if (result != 0)
+    {
+        ::close(fd);
+        return false;
     }
 
+    _fd = fd;
+#endif
+
     return true;
+}
+
+bool sys::file_lock::try_lock(const std::filesystem::path &path)
+{
+    return acquire(path, false);
+}
+
+void sys::file_lock::lock(const std::filesystem::path &path)
+{
+    if (!acquire(path, true))
+        throw std::runtime_error("could not lock " + path.u8string());
+}
+
+void sys::file_lock::unlock()
+{
+#ifdef _WIN32
+    if (_file == nullptr)
+        return;
+
+    // closing the handle releases the lock
+    CloseHandle(_file);
+    _file = nullptr;
+#else
+    if (_fd < 0)
+        return;
+
+    // closing the descriptor releases the lock
+    ::close(_fd);
+    _fd = -1;
 #endif
 }
 
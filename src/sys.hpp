@@ -1,5 +1,7 @@
 #pragma once
-#include <ostream>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -37,10 +39,120 @@
 
 namespace sys
 {
-    int subprocess(const std::string &cmdline, std::ostream &stdout_stream);
-    int subprocess(const std::string &cmdline);
+    struct spawn_options
+    {
+        /**
+        * Called with each chunk read from the child's stdout. If not set,
+        * the child writes to the parent's stdout instead. On Windows this is
+        * called from another thread.
+        **/
+        std::function<void(const char *data, size_t size)> on_output;
+
+        // also send stderr to on_output
+        bool merge_stderr = false;
+
+        // kill the child if it runs longer than this. 0 waits forever.
+        int timeout_ms = 0;
+    };
+
+    /**
+    * Run a program with the given arguments, without going through a shell,
+    * and wait for it to exit. argv[0] is searched for in PATH if it has no
+    * directory. On Linux, the child's stdin is /dev/null.
+    *
+    * Returns the exit code, or -1 if the child was killed by a signal.
+    * Throws if the program can't be started, or if it timed out.
+    **/
+    int spawn(const std::vector<std::string> &argv, const spawn_options &options = {});
 
     bool open_url(const std::string &url);
 
+    /**
+    * Lower the scheduling priority of the calling thread, for background work.
+    **/
+    void lower_thread_priority();
+
+    /**
+    * Get a number that identifies a file on its volume: the device and inode
+    * on Linux, or the volume serial and file index on Windows. Returns false if
+    * the file can't be accessed.
+    **/
+    bool file_index(const std::filesystem::path &path, uint64_t &out_index);
+
+    /**
+    * Create dest as a copy-on-write clone of src (a reflink), which shares
+    * the data of src until either file is written. Returns false if the
+    * filesystem can't do that, in which case dest is not created.
+    **/
+    bool clone_file(const std::filesystem::path &src, const std::filesystem::path &dest);
+
     const std::vector<std::string>& arguments();
+
+    /**
+    * A read-only memory mapping of a whole file.
+    **/
+    class mapped_file
+    {
+    private:
+        const uint8_t *_data = nullptr;
+        size_t _size = 0;
+    #ifdef _WIN32
+        void *_file = nullptr;
+        void *_mapping = nullptr;
+    #endif
+
+    public:
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+        ~mapped_file();
+
+        /**
+        * Map a file, replacing any previous mapping. Returns false if the file
+        * can't be opened or is empty.
+        **/
+        bool open(const std::filesystem::path &path);
+        void close();
+
+        const uint8_t* data() const { return _data; }
+        size_t size() const { return _size; }
+    };
+
+    /**
+    * An exclusive advisory lock on a file, shared with other processes: flock
+    * on POSIX systems, LockFileEx on Windows. The lock file is created if it
+    * doesn't exist, and the lock is released when the file_lock is destroyed,
+    * or when the process exits.
+    **/
+    class file_lock
+    {
+    private:
+    #ifdef _WIN32
+        void *_file = nullptr;
+    #else
+        int _fd = -1;
+    #endif
+
+        bool acquire(const std::filesystem::path &path, bool wait);
+
+    public:
+        file_lock() = default;
+        file_lock(const file_lock&) = delete;
+        file_lock& operator=(const file_lock&) = delete;
+        ~file_lock();
+
+        /**
+        * Take the lock, releasing any lock held before. Returns false if
+        * another process or file_lock holds it. Throws if the lock file
+        * can't be opened.
+        **/
+        bool try_lock(const std::filesystem::path &path);
+
+        /**
+        * Take the lock, waiting for it as long as it is held elsewhere.
+        **/
+        void lock(const std::filesystem::path &path);
+
+        void unlock();
+    };
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include "tasks.hpp"
+
+// the pool and queue the calling thread works for, if any
+static thread_local const tasks::pool *current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+tasks::pool::pool(size_t thread_count) :
+    _push_count(0),
+    _stopping(false)
+{
+    thread_count = std::max<size_t>(thread_count, 1);
+
+    for (size_t i = 0; i < thread_count; i++)
+        _queues.push_back(std::make_unique<queue>());
+
+    for (size_t i = 0; i < thread_count; i++)
+        _threads.emplace_back(&pool::worker_proc, this, i);
+}
+
+tasks::pool::~pool()
+{
+    {
+        std::lock_guard lock(_idle_mutex);
+        _stopping = true;
+    }
+    _idle_cv.notify_all();
+
+    for (auto &thread : _threads)
+        thread.join();
+}
+
+bool tasks::pool::is_worker_thread() const
+{
+    return current_pool == this;
+}
+
+void tasks::pool::push(std::function<void()> task)
+{
+    queue &q = is_worker_thread() ? *_queues[current_queue] : _shared_queue;
+
+    {
+        std::lock_guard lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard lock(_idle_mutex);
+        _push_count++;
+    }
+    _idle_cv.notify_one();
+}
+
+static bool pop_back(std::mutex &mutex, std::deque<std::function<void()>> &tasks, std::function<void()> &out_task)
+{
+    std::lock_guard lock(mutex);
+    if (tasks.empty()) return false;
+
+    out_task = std::move(tasks.back());
+    tasks.pop_back();
+    return true;
+}
+
+static bool pop_front(std::mutex &mutex, std::deque<std::function<void()>> &tasks, std::function<void()> &out_task)
+{
+    std::lock_guard lock(mutex);
+    if (tasks.empty()) return false;
+
+    out_task = std::move(tasks.front());
+    tasks.pop_front();
+    return true;
+}
+
+bool tasks::pool::take(size_t index, std::function<void()> &out_task)
+{
+    // the newest of our own tasks first, its data is most likely still in cache
+    if (pop_back(_queues[index]->mutex, _queues[index]->tasks, out_task))
+        return true;
+
+    if (pop_front(_shared_queue.mutex, _shared_queue.tasks, out_task))
+        return true;
+
+    // then steal the oldest task of another worker
+    for (size_t i = 1; i < _queues.size(); i++)
+    {
+        queue &other = *_queues[(index + i) % _queues.size()];
+        if (pop_front(other.mutex, other.tasks, out_task))
+            return true;
+    }
+
+    return false;
+}
+
+bool tasks::pool::run_own_task()
+{
+    if (!is_worker_thread())
+        return false;
+
+    std::function<void()> task;
+    if (!pop_back(_queues[current_queue]->mutex, _queues[current_queue]->tasks, task))
+        return false;
+
+    task();
+    return true;
+}
+
+void tasks::pool::worker_proc(size_t index)
+{
+    current_pool = this;
+    current_queue = index;
+
+    while (true)
+    {
+        uint64_t seen_pushes;
+        bool stopping;
+        {
+            std::lock_guard lock(_idle_mutex);
+            seen_pushes = _push_count;
+            stopping = _stopping;
+        }
+
+        // submitted tasks are packaged_tasks, which catch their own exceptions
+        std::function<void()> task;
+        if (take(index, task))
+        {
+            task();
+            continue;
+        }
+
+        // queued tasks are still run when stopping
+        if (stopping)
+            return;
+
+        // anything pushed after seen_pushes was read may have been missed by take
+        std::unique_lock lock(_idle_mutex);
+        _idle_cv.wait(lock, [&]{ return _stopping || _push_count != seen_pushes; });
+    }
+}
+
+tasks::pool& tasks::shared()
+{
+    static pool instance(std::max(std::thread::hardware_concurrency(), 2u));
+    return instance;
+}
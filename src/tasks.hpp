@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace tasks
+{
+    /**
+    * A flag that asks a task to stop early. Copies share the same flag, so a
+    * task can hold its own copy and outlive whoever canceled it.
+    **/
+    class cancel_token
+    {
+    private:
+        std::shared_ptr<std::atomic<bool>> _flag;
+
+    public:
+        cancel_token() : _flag(std::make_shared<std::atomic<bool>>(false))
+        {}
+
+        void cancel() { *_flag = true; }
+        bool is_canceled() const { return *_flag; }
+
+        // for functions that take a cancel flag, like catalog::fetch
+        const std::atomic<bool>* flag() const { return _flag.get(); }
+    }; // class cancel_token
+
+    /**
+    * A fixed set of worker threads, each with its own task queue. Tasks
+    * submitted from a worker go to that worker's queue, and others to a shared
+    * one. A worker runs the newest task of its own queue first, then the oldest
+    * shared task, and when both are empty, steals the oldest task of another
+    * worker.
+    **/
+    class pool
+    {
+    private:
+        struct queue
+        {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<queue>> _queues;
+        queue _shared_queue;
+        std::vector<std::thread> _threads;
+
+        // counts pushes, so that idle workers can tell when there is new work
+        std::mutex _idle_mutex;
+        std::condition_variable _idle_cv;
+        uint64_t _push_count;
+        bool _stopping;
+
+        void push(std::function<void()> task);
+        bool take(size_t index, std::function<void()> &out_task);
+        void worker_proc(size_t index);
+
+    public:
+        pool(const pool&) = delete;
+        pool& operator=(pool const&) = delete;
+
+        pool(size_t thread_count);
+
+        // runs the tasks that are still queued, then stops the workers
+        ~pool();
+
+        size_t thread_count() const { return _threads.size(); }
+
+        /**
+        * Queue a function to be run on a worker. Its result, or the exception
+        * it threw, is delivered through the returned future.
+        **/
+        template <typename F>
+        std::future<std::invoke_result_t<F>> submit(F &&func)
+        {
+            using result_t = std::invoke_result_t<F>;
+
+            auto task = std::make_shared<std::packaged_task<result_t()>>(std::forward<F>(func));
+            std::future<result_t> future = task->get_future();
+            push([task]() { (*task)(); });
+            return future;
+        }
+
+        /**
+        * Returns true if the calling thread is one of the workers.
+        **/
+        bool is_worker_thread() const;
+
+        /**
+        * On a worker, run the newest task of its own queue. These are the tasks
+        * that the worker's current task submitted, so nothing unrelated, like a
+        * long install, gets run in the middle of it.
+        **/
+        bool run_own_task();
+
+        /**
+        * Block until the future is ready. On a worker, its own queued tasks are
+        * run in the meantime, so a task can wait for tasks it submitted without
+        * leaving the pool short of a thread.
+        **/
+        template <typename T>
+        void wait(const std::future<T> &future)
+        {
+            if (!is_worker_thread())
+            {
+                future.wait();
+                return;
+            }
+
+            while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                // it was stolen by another worker, and is running there
+                if (!run_own_task())
+                    future.wait_for(std::chrono::milliseconds(1));
+            }
+        }
+    }; // class pool
+
+    /**
+    * The pool that all background work shares, with a thread per core.
+    **/
+    pool& shared();
+} // namespace tasks
@@ -1,4 +1,5 @@
 #include "util.hpp"
+#include <atomic>
 #include <cassert>
 
 std::string util::format(const char *fmt, ...)
@@ -39,4 +40,16 @@ std::string util::vformat(const char* fmt, va_list args)
     // write formatted string into buffer
     vsnprintf(str.data(), str.size(), fmt, args);
     return str;
-}
\ No newline at end of file
+}
+static std::atomic<void (*)()> wake_handler = nullptr;
+
+void util::set_wake_handler(void (*handler)())
+{
+    wake_handler = handler;
+}
+
+void util::wake_main_loop()
+{
+    void (*handler)() = wake_handler;
+    if (handler) handler();
+}
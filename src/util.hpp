@@ -20,6 +20,17 @@ namespace util
     * vsprintf into std::string
     **/
     std::string vformat(const char *fmt, va_list va);
+
+    /**
+    * Set the function that wakes the main loop, called by wake_main_loop.
+    **/
+    void set_wake_handler(void (*handler)());
+
+    /**
+    * Make the main loop draw a frame if it is idle. Can be called from
+    * any thread, e.g. by background work whose progress is shown.
+    **/
+    void wake_main_loop();
 }
 
 #undef PRINTF_FORMAT
\ No newline at end of file
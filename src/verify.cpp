@@ -0,0 +1,243 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include "verify.hpp"
+#include "archive.hpp"
+#include "delta.hpp"
+#include "download.hpp"
+#include "store.hpp"
+#include "sys.hpp"
+#include "tasks.hpp"
+#include "json.hpp"
+
+using namespace nlohmann;
+
+// a file written this soon after the recorded install time is still counted
+// as part of the install, for filesystems with coarse timestamps
+constexpr auto MODIFIED_SLACK = std::chrono::seconds(2);
+
+namespace
+{
+    struct manifest_entry
+    {
+        std::filesystem::path path;
+        uint64_t size;
+        uint64_t hash;
+    };
+}
+
+static std::filesystem::path manifest_path()
+{
+    return download::rainedvm_path() / "manifest.json";
+}
+
+static bool load_manifest(const std::string &key, std::vector<manifest_entry> &out_manifest)
+{
+    std::ifstream stream(manifest_path());
+    if (!stream.is_open())
+        return false;
+
+    try
+    {
+        json data = json::parse(stream);
+        if (data.at("key") != key)
+            return false;
+
+        for (auto &file : data.at("files"))
+        {
+            out_manifest.push_back({
+                std::filesystem::u8path(file.at("path").get<std::string>()),
+                file.at("size").get<uint64_t>(),
+                file.at("hash").get<uint64_t>()
+            });
+        }
+    }
+    catch (json::exception &e)
+    {
+        fprintf(stderr, "could not read manifest.json: %s\n", e.what());
+        out_manifest.clear();
+        return false;
+    }
+
+    return true;
+}
+
+static void save_manifest(const std::string &key, const std::vector<manifest_entry> &manifest)
+{
+    json files = json::array();
+    for (auto &entry : manifest)
+        files.push_back({ { "path", entry.path.u8string() }, { "size", entry.size }, { "hash", entry.hash } });
+
+    json data;
+    data["key"] = key;
+    data["files"] = std::move(files);
+
+    std::ofstream stream(manifest_path());
+    stream << data.dump();
+}
+
+// extract the whole archive once, which is much faster than extracting each
+// file on its own from a .tar.gz, and hash the files on all cores
+static std::vector<manifest_entry> build_manifest(archive::basic_archive &archive)
+{
+    std::filesystem::path tmp_dir = download::rainedvm_path() / "manifest-tmp";
+    std::filesystem::remove_all(tmp_dir);
+    std::filesystem::create_directories(tmp_dir);
+    archive.extract_all(tmp_dir);
+
+    std::vector<std::future<manifest_entry>> entries;
+    for (auto &path : archive.files())
+    {
+        if (!verify::is_checked(path))
+            continue;
+
+        entries.push_back(tasks::shared().submit([file_path = tmp_dir / path, path]()
+        {
+            manifest_entry entry { path, std::filesystem::file_size(file_path), 0 };
+            if (!delta::hash_file(file_path, entry.hash))
+                throw std::runtime_error("could not read " + file_path.u8string());
+
+            return entry;
+        }));
+    }
+
+    // every task has to be done with the files before they are removed
+    for (auto &entry : entries)
+        tasks::shared().wait(entry);
+
+    std::error_code ec;
+    std::filesystem::remove_all(tmp_dir, ec);
+
+    std::vector<manifest_entry> manifest;
+    for (auto &entry : entries)
+        manifest.push_back(entry.get());
+
+    return manifest;
+}
+
+static verify::file_state check_file(const std::filesystem::path &path, const manifest_entry &entry, std::filesystem::file_time_type installed_time)
+{
+    std::error_code ec;
+    std::filesystem::file_status status = std::filesystem::status(path, ec);
+    if (!std::filesystem::exists(status))
+        return verify::file_state::missing;
+
+    // the size decides most mismatches without reading the file
+    bool is_intact = false;
+    if (std::filesystem::is_regular_file(status))
+    {
+        uint64_t size = std::filesystem::file_size(path, ec);
+        uint64_t hash;
+        is_intact = !ec && size == entry.size && delta::hash_file(path, hash) && hash == entry.hash;
+    }
+
+    if (is_intact)
+        return verify::file_state::ok;
+
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    if (!ec && mtime > installed_time + MODIFIED_SLACK)
+        return verify::file_state::modified;
+
+    return verify::file_state::corrupted;
+}
+
+const char* verify::state_name(file_state state)
+{
+    switch (state)
+    {
+        case file_state::ok: return "ok";
+        case file_state::missing: return "missing";
+        case file_state::corrupted: return "corrupted";
+        case file_state::modified: return "modified";
+    }
+
+    return "";
+}
+
+bool verify::is_checked(const std::filesystem::path &entry_path)
+{
+    if (!entry_path.has_filename())
+        return false;
+
+    // don't check the version manager executable or config/imgui.ini, which
+    // installing doesn't replace, or the drizzle cast folder, which it doesn't check.
+    // depending on the version, the latter may be called "internal" or "drizzle-cast".
+    std::filesystem::path vm_exe_path = std::filesystem::path(sys::arguments()[0]).filename();
+    std::string path_str = entry_path.u8string();
+
+    return entry_path != vm_exe_path &&
+        entry_path != "config/imgui.ini" &&
+        path_str.substr(0, 15) != "assets/internal" &&
+        path_str.substr(0, 19) != "assets/drizzle-cast";
+}
+
+verify::report verify::check(const std::filesystem::path &rained_dir, const std::filesystem::path &archive_path)
+{
+    std::string key = archive::archive_key(archive_path);
+
+    std::vector<manifest_entry> manifest;
+    if (!load_manifest(key, manifest))
+    {
+        printf("building manifest of %s\n", archive_path.u8string().c_str());
+        auto archive = archive::open_release_archive(archive_path);
+        manifest = build_manifest(*archive);
+        save_manifest(key, manifest);
+    }
+
+    // anything written after the files were installed was changed by something
+    // else. without a record, every damaged file counts as modified, so that
+    // a repair doesn't overwrite edits without asking.
+    store::installation installation;
+    std::filesystem::file_time_type installed_time = std::filesystem::file_time_type::min();
+    if (store::load_installed(installation))
+        installed_time = installation.installed_time;
+
+    std::vector<std::future<file_state>> states;
+    for (const manifest_entry &entry : manifest)
+    {
+        states.push_back(tasks::shared().submit([&rained_dir, &entry, installed_time]()
+        {
+            return check_file(rained_dir / entry.path, entry, installed_time);
+        }));
+    }
+
+    // the tasks refer to the manifest, so let them all finish first
+    for (auto &state : states)
+        tasks::shared().wait(state);
+
+    report result;
+    result.files_checked = manifest.size();
+
+    for (size_t i = 0; i < manifest.size(); i++)
+    {
+        file_state state = states[i].get();
+        if (state != file_state::ok)
+            result.damaged.push_back({ manifest[i].path, state });
+    }
+
+    return result;
+}
+
+void verify::repair(const std::filesystem::path &rained_dir, const std::filesystem::path &archive_path, const std::vector<std::filesystem::path> &entry_paths)
+{
+    if (entry_paths.empty())
+        return;
+
+    auto archive = archive::open_release_archive(archive_path);
+
+    for (auto &path : entry_paths)
+    {
+        std::filesystem::path dest_path = rained_dir / path;
+        printf("repairing %s\n", path.u8string().c_str());
+
+        // a damaged file may be read-only or a broken link, which extracting
+        // over would fail on
+        std::error_code ec;
+        std::filesystem::remove(dest_path, ec);
+        if (path.has_parent_path())
+            std::filesystem::create_directories(dest_path.parent_path());
+
+        archive->extract_file(path, rained_dir);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+* Checks an installed Rained tree against the archive of the installed version,
+* and repairs it by extracting only the files that are damaged.
+*
+* The size and hash of every file in the archive are kept in a manifest in
+* .rainedvm/manifest.json, built the first time an archive is verified. A check
+* then only reads the installed files: the size is compared first, and only
+* files of the right size are hashed, spread over the task pool.
+**/
+namespace verify
+{
+    enum class file_state
+    {
+        ok,
+        missing,
+
+        // different from the archive, but not written since the install.
+        // damaged by something other than the user, like a crash or a disk error.
+        corrupted,
+
+        // different from the archive, and written after the install
+        modified
+    };
+
+    struct file_result
+    {
+        std::filesystem::path path;
+        file_state state;
+    };
+
+    struct report
+    {
+        size_t files_checked = 0;
+
+        // every file that isn't ok, in archive order
+        std::vector<file_result> damaged;
+    };
+
+    const char* state_name(file_state state);
+
+    /**
+    * Returns false for the entries of an archive that installing leaves
+    * alone: directories, the version manager and user settings.
+    **/
+    bool is_checked(const std::filesystem::path &entry_path);
+
+    /**
+    * Compare the files in rained_dir with the release archive they were
+    * installed from. Throws if the archive can't be read.
+    **/
+    report check(const std::filesystem::path &rained_dir, const std::filesystem::path &archive_path);
+
+    /**
+    * Extract the given entries of the archive into rained_dir, replacing
+    * the files that are there.
+    **/
+    void repair(const std::filesystem::path &rained_dir, const std::filesystem::path &archive_path, const std::vector<std::filesystem::path> &entry_paths);
+}